@@ -2,13 +2,15 @@
 #include "errors.h"
 #include "util.h"
 #include "device.h"
+#include "pgm.h"
 #include <Arduino.h>
 #include <string.h>
 
 Command::Command() {};
 
 Command::Command(char id[4], CommandType type) {
-    strncpy(this->device_id, id, 4);
+    strncpy(this->device_id, id, 3);
+    this->device_id[3] = 0;
     this->type = type;
 }
 
@@ -21,6 +23,21 @@ CommandType Command::get_type() {
     return this->type;
 };
 
+// hub commands act on the hub itself (diagnostics, serial settings)
+// rather than a SmartHomeState so execute() doesnt handle them
+// this keeps the engine free of any process wide state
+bool Command::is_hub_command() {
+    switch (this->type) {
+        case Stats:
+        case ResetStats:
+        case Trace:
+        case Verbose:
+            return true;
+        default:
+            return false;
+    };
+};
+
 void Command::get_device_id(char* buf) {
     strncpy(buf, this->device_id, 4);
 }
@@ -36,6 +53,8 @@ CommandType Command::char_to_command_type(char c) {
             return Power;
         case 'R':
             return Remove;
+        case 'D':
+            return Schedule;
         default:
             return NotACommand;
     };
@@ -44,17 +63,45 @@ CommandType Command::char_to_command_type(char c) {
 
 HRESULT Command::create(char str[24], Command* command) {
 
-    if (strcmp(str, "WRITE") == 0) {
+    if (strcmp_P(str, PSTR("WRITE")) == 0) {
         *command = Command(CommandType::Write);
         return S_OK;
     };
 
+    if (strcmp_P(str, PSTR("STATS")) == 0) {
+        *command = Command(CommandType::Stats);
+        return S_OK;
+    };
+
+    // resets the STATS counters, not the devices
+    if (strcmp_P(str, PSTR("RESET")) == 0) {
+        *command = Command(CommandType::ResetStats);
+        return S_OK;
+    };
+
+    if (strcmp_P(str, PSTR("TRACE")) == 0) {
+        *command = Command(CommandType::Trace);
+        return S_OK;
+    };
+
+    // switches replies between codes (K, C<hresult>, E<hresult>) and text
+    if (strcmp_P(str, PSTR("VERBOSE")) == 0) {
+        *command = Command(CommandType::Verbose);
+        return S_OK;
+    };
+
+    // SYNC-EPOCH-VERSION, the numbers are read when it is executed
+    if (strncmp_P(str, PSTR("SYNC-"), 5) == 0) {
+        *command = Command(CommandType::Sync);
+        return S_OK;
+    };
+
   
     if (strlen(str) < MIN_COMMAND_LEN) {
         return E_COMMAND_GENERAL_INVALID;
     };
 
-    // REMOVE COMMAND MAY NOT HAVE A SECOND -
+    // REMOVE (AND CANCEL SCHEDULE) COMMAND MAY NOT HAVE A SECOND -
     if (str[1] != '-' || (str[5] != '-' && str[5] != 0)) {
         return E_COMMAND_FORMAT_INVALID;
     };
@@ -85,7 +132,7 @@ HRESULT Command::create(char str[24], Command* command) {
 }
 
 
-HRESULT Command::execute(SmartHomeState* state, char command_buffer[24]) {
+HRESULT Command::execute(SmartHomeState* state, char command_buffer[24], unsigned long now) {
     switch (this->type) {
         case Add:
             return this->execute_add(state, command_buffer);
@@ -97,9 +144,15 @@ HRESULT Command::execute(SmartHomeState* state, char command_buffer[24]) {
 
         case Remove:
             return this->execute_remove(state, command_buffer);
+
+        case Schedule:
+            return this->execute_schedule(state, command_buffer, now);
         
         case Write:
-            return state->write_devices_to_eeprom();
+            return state->write_devices_to_storage();
+
+        case Sync:
+            return this->execute_sync(state, command_buffer);
 
         default:
             return E_COMMAND_NOT_A_COMMAND;
@@ -148,9 +201,9 @@ HRESULT Command::execute_add(SmartHomeState* state, char command_buffer[24]) {
     };
     memcpy(device.id, this->device_id, 3);
     memcpy(device.location, location, 15);
-    HRESULT hresult = state->add_device(device);
+    HRESULT hresult = state->add_device(&device);
     if (hresult == E_STATE_CONFLICTING_DEVICE) {
-        return state->overwrite_device(device);
+        return state->overwrite_device(&device);
     } else {
         return hresult;
     };
@@ -161,9 +214,9 @@ HRESULT Command::execute_state(SmartHomeState* state, char command_buffer[24]) {
     memcpy(state_buf, command_buffer + CMD_OFFSET, 3);
 
     bool device_state;
-    if (strcmp(state_buf, "OFF") == 0) {
+    if (strcmp_P(state_buf, PSTR("OFF")) == 0) {
         device_state = false;
-    } else if (strcmp(state_buf, "ON") == 0) {
+    } else if (strcmp_P(state_buf, PSTR("ON")) == 0) {
         device_state = true;
         } else {
         return E_COMMAND_UNKNOWN_STATE;
@@ -184,3 +237,80 @@ HRESULT Command::execute_power(SmartHomeState* state, char command_buffer[24]) {
 HRESULT Command::execute_remove(SmartHomeState* state, char command_buffer[24]) {
     return state->remove_device(this->device_id);
 };
+
+// D-ABC-DELAY-ACTION[-PERIOD] schedules ACTION in DELAY seconds
+// repeating every PERIOD seconds if given
+// ACTION is ON, OFF or a power level
+// D-ABC on its own cancels everything scheduled for ABC
+HRESULT Command::execute_schedule(SmartHomeState* state, char command_buffer[24], unsigned long now) {
+    if (command_buffer[CMD_OFFSET - 1] == 0) {
+        state->cancel_scheduled(this->device_id);
+        return S_OK;
+    };
+
+    char* cursor = command_buffer + CMD_OFFSET;
+    char* end;
+
+    unsigned long delay = strtoul(cursor, &end, 10);
+    if (end == cursor || *end != '-') {
+        return E_COMMAND_FORMAT_INVALID;
+    };
+    cursor = end + 1;
+
+    ScheduledActionType type;
+    int value;
+    if (strncmp_P(cursor, PSTR("ON"), 2) == 0) {
+        type = SetState;
+        value = true;
+        end = cursor + 2;
+    } else if (strncmp_P(cursor, PSTR("OFF"), 3) == 0) {
+        type = SetState;
+        value = false;
+        end = cursor + 3;
+    } else {
+        type = SetPower;
+        value = strtol(cursor, &end, 10);
+        if (end == cursor) {
+            return E_COMMAND_UNKNOWN_STATE;
+        };
+    };
+
+    unsigned long period = 0;
+    if (*end == '-') {
+        cursor = end + 1;
+        period = strtoul(cursor, &end, 10);
+        if (end == cursor || period == 0) {
+            return E_COMMAND_VALUE_OUT_OF_RANGE;
+        };
+    };
+
+    if (*end != 0) {
+        return E_COMMAND_FORMAT_INVALID;
+    };
+
+    if (delay > SCHEDULE_MAX_SECONDS || period > SCHEDULE_MAX_SECONDS) {
+        return E_COMMAND_VALUE_OUT_OF_RANGE;
+    };
+
+    return state->schedule_action(this->device_id, type, value, now, delay * 1000, period * 1000);
+};
+
+// SYNC-EPOCH-VERSION replies with what changed after VERSION
+// both come from the V line of the last reply (SYNC-0-0 the first time)
+HRESULT Command::execute_sync(SmartHomeState* state, char command_buffer[24]) {
+    char* cursor = command_buffer + 5;
+    char* end;
+
+    unsigned long epoch = strtoul(cursor, &end, 10);
+    if (end == cursor || *end != '-' || epoch > 0xFFFF) {
+        return E_COMMAND_FORMAT_INVALID;
+    };
+    cursor = end + 1;
+
+    unsigned long since = strtoul(cursor, &end, 10);
+    if (end == cursor || *end != 0 || since > 0xFFFF) {
+        return E_COMMAND_FORMAT_INVALID;
+    };
+
+    return state->send_changes_since(epoch, since);
+};
@@ -9,27 +9,37 @@ enum CommandType: char {
     State,
     Power,
     Remove,
+    Schedule,
     Write,
+    Stats,
+    ResetStats,
+    Trace,
+    Verbose,
+    Sync,
     NotACommand
 };
 
 class Command {
     private:
         Command(char*, CommandType);
-        Command(CommandType type); // write command
+        Command(CommandType type); // commands without a device (WRITE, STATS, RESET, TRACE, VERBOSE, SYNC-)
         static enum CommandType char_to_command_type (char);
         HRESULT execute_add(SmartHomeState*, char[24]);
         HRESULT execute_state(SmartHomeState*, char[24]);
         HRESULT execute_power(SmartHomeState*, char[24]);
         HRESULT execute_remove(SmartHomeState*, char[24]);
+        HRESULT execute_schedule(SmartHomeState*, char[24], unsigned long);
+        HRESULT execute_sync(SmartHomeState*, char[24]);
         CommandType type;
     public:
         Command(); // for null instantiation to be overwritten by ::create
         char device_id[4];
         static HRESULT create(char[24], Command*);
         enum CommandType get_type();
+        bool is_hub_command();
         void get_device_id(char*);
-        HRESULT execute(SmartHomeState*, char[24]);
+        // now is in ms, the engine has no clock of its own
+        HRESULT execute(SmartHomeState*, char[24], unsigned long);
 };
 
 #endif
\ No newline at end of file
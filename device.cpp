@@ -16,4 +16,22 @@ DeviceType char_to_device_type(char c) {
             return NotADevice;
     };
     
+}
+
+// the letter used for the type in commands, 0 if it isnt a device
+char device_type_to_char(DeviceType type) {
+    switch (type) {
+        case Speaker:
+            return 'S';
+        case Socket:
+            return 'O';
+        case Light:
+            return 'L';
+        case Thermostat:
+            return 'T';
+        case Camera:
+            return 'C';
+        default:
+            return 0;
+    };
 }
\ No newline at end of file
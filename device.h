@@ -21,4 +21,5 @@ struct Device {
 };
 
 DeviceType char_to_device_type(char);
+char device_type_to_char(DeviceType);
 #endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "eeprom_storage.h"
+#include "stats.h"
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+unsigned int EepromStorage::length() {
+    return EEPROM.length();
+};
+
+unsigned char EepromStorage::read(unsigned int address) {
+    return EEPROM.read(address);
+};
+
+void EepromStorage::read_block(unsigned int address, void* buf, unsigned int len) {
+    unsigned char* bytes = (unsigned char*) buf;
+    for (unsigned int i = 0; i < len; i++) {
+        bytes[i] = EEPROM.read(address + i);
+    };
+};
+
+// only writes cells that have changed
+// to save on the ~100k write cycles each cell has
+// (what EEPROM.update does, but we want to count them)
+void EepromStorage::write_block(unsigned int address, const void* buf, unsigned int len) {
+    const unsigned char* bytes = (const unsigned char*) buf;
+    unsigned int written = 0;
+    for (unsigned int i = 0; i < len; i++) {
+        if (EEPROM.read(address + i) != bytes[i]) {
+            EEPROM.write(address + i, bytes[i]);
+            written++;
+        };
+    };
+    stats_record_eeprom_bytes(written);
+};
@@ -0,0 +1,15 @@
+#ifndef EEPROM_STORAGE_H
+#define EEPROM_STORAGE_H
+
+#include "storage.h"
+
+// the avr's built in 1KB eeprom
+class EepromStorage : public Storage {
+    public:
+        unsigned int length();
+        unsigned char read(unsigned int);
+        void read_block(unsigned int, void*, unsigned int);
+        void write_block(unsigned int, const void*, unsigned int);
+};
+
+#endif
@@ -20,6 +20,7 @@ enum HRESULT : unsigned char {
     E_STATE_CONFLICTING_DEVICE,
     E_STATE_PANIC, // something has gone terribly wrong
     E_STATE_EEPROM_FULL,
+    E_STATE_SCHEDULE_FULL,
     
 
 };
@@ -2,10 +2,16 @@
 #include <Adafruit_RGBLCDShield.h>
 #include <Arduino.h>
 #include <utility/Adafruit_MCP23017.h>
+#include <avr/sleep.h>
 
 #include "command.h"
 #include "device.h"
+#include "eeprom_storage.h"
 #include "errors.h"
+#include "marquee.h"
+#include "pgm.h"
+#include "sram.h"
+#include "stats.h"
 #include "util.h"
 
 #define FEATURES "BASIC & UDCHARS, FREERAM, HCI, SCROLL, EEPROM"
@@ -14,25 +20,71 @@
 #define GREEN '\2'
 #define PURPLE '\5'
 
+// the shield has no button interrupt line wired
+// so while idle we still wake up this often to poll the buttons
+#define IDLE_POLL_MS 50
+
 // LCD
 Adafruit_RGBLCDShield lcd = Adafruit_RGBLCDShield();
 
+// custom characters, indexed by their character code
+#define NUM_CUSTOM_CHARS 4
+const uint8_t CUSTOM_CHARS[NUM_CUSTOM_CHARS][8] PROGMEM = {
+    {0,0,0,0,0,0,0,0}, // NULL_CHAR, stops the LCD displaying gibberish when it is passed a NULL
+    {4,14,21,4,4,4,4,0}, // UP_ARROW
+    {0,4,4,4,4,21,14,4}, // DOWN_ARROW
+    {7,5,7,0,0,0,0,0}, // DEGREE_CHAR
+};
+
 // GLOBAL STATE
 SmartHomeState state = SmartHomeState();
+EepromStorage eeprom = EepromStorage();
 
 // DISPLAY STATE
 DisplayFlags current_display_flags = NO_DEVICES;
 DisplayMode prev_display_mode = ALL_DEVICES;
 
+// SERIAL
+// time for a whole command to arrive once we see the start of it
+// scaled down from 100ms at 9600 baud when the host negotiates a faster rate
+unsigned int command_wait_ms = 100;
+
+// compact replies by default (K, C<hresult>, E<hresult>)
+// VERBOSE switches to readable text
+bool verbose_replies = false;
+
 // BUTTON STATE
 unsigned long input_available_after = 0;
 
 // SCROLLING
-unsigned long next_scroll_update;
-// this theoretically can still be 16 long but it ensures memory safety
-// should we have a non null terminated string copied in ...
-char scrolling_text[16+4] = {0}; // 16 chars + blank to show end of scroll
-NUMBER scrolling_index = 0;
+// the location field, 11 cells after the id
+// points straight at the location of the device on screen
+// this is safe as any change to the device table sets is_current = false
+// which redraws (and restarts the marquee) before we scroll again
+Marquee location_marquee = Marquee(5, 0, 11);
+
+// TRACING
+unsigned char traced_buttons = 0;
+
+// the ide generates these, written out so the sketch
+// also builds as plain c++ (host/replay)
+void flush_serial();
+void wait_for_sync();
+void negotiate_baud();
+HRESULT execute_hub_command(CommandType);
+void idle_until_next_event(unsigned char, unsigned long);
+void trace_command(char[]);
+void trace_buttons(unsigned char);
+void process_buttons(unsigned char);
+void lock_buttons_for(unsigned long);
+void unlock_buttons();
+bool button_presses_disabled();
+void display_message(const __FlashStringHelper*, unsigned char);
+void write_field(const char*, NUMBER);
+void write_field_P(PGM_P, NUMBER);
+void draw_display(const Device*, DisplayFlags);
+void update_display(unsigned char);
+void scroll_display_text();
 
 void flush_serial() {
     while(Serial.available()) {
@@ -54,18 +106,68 @@ void wait_for_sync() {
 };
 
 
+// host replies to the Q's with an X, it can then follow with
+// B and a digit to switch to a faster baud rate
+// we echo the request at the old rate before switching
+void negotiate_baud() {
+    unsigned long give_up_at = millis() + 100;
+    while (Serial.available() < 2 && millis() < give_up_at) {};
+
+    if (Serial.available() < 2 || Serial.peek() != 'B') {
+        return; // stay at 9600 for hosts that dont know about this
+    };
+    Serial.read();
+    char rate = Serial.read();
+
+    unsigned long baud;
+    switch (rate) {
+        case '0':
+            baud = 9600;
+            break;
+        case '1':
+            baud = 19200;
+            break;
+        case '2':
+            baud = 38400;
+            break;
+        case '3':
+            baud = 57600;
+            break;
+        case '4':
+            baud = 115200;
+            break;
+        default:
+            return;
+    };
+
+    Serial.write('B');
+    Serial.write(rate);
+    Serial.flush(); // wait for the echo to go out at the old rate
+    Serial.end();
+    Serial.begin(baud);
+    command_wait_ms = 960000ul / baud;
+}
+
 void setup() {
+    // before anything else so the whole gap is painted
+    paint_stack();
+
     Serial.begin(9600);
     lcd.begin(16, 2);
     lcd.clear();
     lcd.setBacklight(PURPLE);
     wait_for_sync();
+    negotiate_baud();
     flush_serial();
 
     Serial.println();
     Serial.println(F("Reading EEPROM ... this may take a while."));
 
-    unsigned NUMBER eeprom_devices = state.read_devices_from_eeprom();
+    unsigned long stats_start = stats_begin();
+    state.use_storage(&eeprom);
+    state.use_output(&Serial);
+    unsigned NUMBER eeprom_devices = state.read_devices_from_storage();
+    stats_end(PHASE_EEPROM, stats_start);
 
     Serial.print(F("Loaded "));
     Serial.print(eeprom_devices);
@@ -73,49 +175,66 @@ void setup() {
 
     Serial.println(F(FEATURES));
     lcd.setBacklight(WHITE);
-    // Stop the LCD displaying gibberish when it is passed a NULL
 
 
     // custom characters for the display
-    // this doesnt work with progmem so we declare it here
-    // so it can go out of scope once we are finished setting up
-    const uint8_t UP_ARROW[8] = {4,14,21,4,4,4,4,0};
-    const uint8_t DOWN_ARROW[8] = {0,4,4,4,4,21,14,4};
-    const uint8_t NULL_CHAR[8] = {0,0,0,0,0,0,0,0};
-    const uint8_t DEGREE_CHAR[8] = {7,5,7,0,0,0,0,0};
-
-
+    // createChar reads from ram so copy each one
+    // out of flash into a single buffer first
+    uint8_t glyph[8];
+    for (unsigned NUMBER i = 0; i < NUM_CUSTOM_CHARS; i++) {
+        memcpy_P(glyph, CUSTOM_CHARS[i], 8);
+        lcd.createChar(i, glyph);
+    };
 
-    lcd.createChar(0, NULL_CHAR);
-    lcd.createChar(1, UP_ARROW);
-    lcd.createChar(2, DOWN_ARROW);
-    lcd.createChar(3, DEGREE_CHAR);
+    stats_record_static_ram(RAM_DEVICES, sizeof state);
+    stats_record_static_ram(RAM_BUFFERS, sizeof location_marquee);
+    stats_record_static_ram(RAM_LCD, sizeof lcd);
+    stats_record_static_ram(RAM_SERIAL, sizeof Serial);
 
 };
 
 void loop() {
+    // how long this pass took is what a sleep saves per pass
+    unsigned long loop_start = micros();
 
     // Read and execute commands FIRST
     // THEN update display (from buttons)
     if (Serial.available() >= MIN_COMMAND_LEN) {
 
-        delay(100); // wait a bit here to ENSURE we have the entire byte sequence
+        delay(command_wait_ms); // wait a bit here to ENSURE we have the entire byte sequence
+
+        // the delay above is fixed so it is left out of the parse timing
+        unsigned long stats_start = stats_begin();
         char command_buffer[24] = {0};
         // The longest valid command is 23, chars
         // so read 23 chars and flush the rest of
         // the buffer to discard the rest (if any)
-        Serial.readBytes(command_buffer, 23);
+        // only read what has arrived, readBytes would otherwise sit
+        // out its 1s timeout on every command shorter than 23 chars
+        int available = Serial.available();
+        Serial.readBytes(command_buffer, available < 23 ? available : 23);
         
         // discard
         flush_serial();
 
+        if (stats_tracing()) {
+            trace_command(command_buffer);
+        };
+
 
         Command command;
 
         HRESULT create_hresult = Command::create(command_buffer, &command); 
+        stats_end(PHASE_SERIAL_PARSE, stats_start);
+        stats_record_command();
         
         if (create_hresult != S_OK) {
-            Serial.print(F("CREATE ERROR : "));
+            stats_record_error(create_hresult);
+            if (verbose_replies) {
+                Serial.print(F("CREATE ERROR : "));
+            } else {
+                Serial.print('C');
+            };
             Serial.println(create_hresult);
             return;
         };
@@ -124,23 +243,55 @@ void loop() {
 
         HRESULT exec_hresult;
 
-        if (command.get_type() == CommandType::Write) {
+        if (command.get_type() == CommandType::Write && verbose_replies) {
             Serial.print(F("Writing ... "));
         }
 
-        exec_hresult = command.execute(&state, command_buffer);
+        // WRITE is timed on its own so EXEC stays comparable
+        StatPhase phase = command.get_type() == CommandType::Write ? PHASE_EEPROM : PHASE_EXECUTE;
+        stats_start = stats_begin();
+        if (command.is_hub_command()) {
+            exec_hresult = execute_hub_command(command.get_type());
+        } else {
+            exec_hresult = command.execute(&state, command_buffer, millis());
+        };
+        stats_end(phase, stats_start);
 
         if (exec_hresult != S_OK) {
-            Serial.print(F("EXEC ERROR : "));
+            stats_record_error(exec_hresult);
+            if (verbose_replies) {
+                Serial.print(F("EXEC ERROR : "));
+            } else {
+                Serial.print('E');
+            };
             Serial.println(exec_hresult);
             return;
         };
 
-        Serial.println(F("OK"));
+        if (verbose_replies) {
+            Serial.println(F("OK"));
+        } else {
+            Serial.println('K');
+        };
 
     };
+    // fire anything that is due before we draw
+    unsigned long now = millis();
+    HRESULT scheduled_hresult;
+    while (state.run_next_scheduled(now, &scheduled_hresult)) {
+        if (scheduled_hresult != S_OK) {
+            stats_record_error(scheduled_hresult);
+        };
+    };
+
+    unsigned long stats_start = stats_begin();
     unsigned char button_state = lcd.readButtons();
-    state.update_pressed_buttons(button_state);
+    state.update_pressed_buttons(button_state, millis());
+    stats_end(PHASE_READ_BUTTONS, stats_start);
+
+    if (stats_tracing() && button_state != traced_buttons) {
+        trace_buttons(button_state);
+    };
 
     // process buttons
     if (!button_presses_disabled()) {
@@ -148,10 +299,113 @@ void loop() {
     }
 
     if (state.display_mode != STUDENT_ID) {
+        stats_start = stats_begin();
         update_display(button_state);
+        stats_end(PHASE_DISPLAY, stats_start);
     };
+
+    stats_record_loop();
+    idle_until_next_event(button_state, loop_start);
 };
 
+// commands for the hub rather than the devices in it
+HRESULT execute_hub_command(CommandType type) {
+    switch (type) {
+        case Stats:
+            print_stats();
+            return S_OK;
+
+        case ResetStats:
+            reset_stats();
+            return S_OK;
+
+        case Trace:
+            stats_toggle_trace();
+            return S_OK;
+
+        case Verbose:
+            verbose_replies = !verbose_replies;
+            return S_OK;
+
+        default:
+            return E_COMMAND_NOT_A_COMMAND;
+    };
+}
+
+// sleeps until the next thing that could change the screen
+// idle sleep keeps timer0 (millis) and the uart running
+// so a byte arriving or a timer tick wakes us straight back up
+void idle_until_next_event(unsigned char button_state, unsigned long loop_start) {
+    // a held button is timed (e.g long press select) so keep polling
+    // and dont sleep with a redraw or a command waiting
+    if (button_state || !state.is_current || Serial.available()) {
+        return;
+    };
+
+    unsigned long loop_us = micros() - loop_start;
+    unsigned long now = millis();
+    unsigned long deadline = now + IDLE_POLL_MS;
+    unsigned long other;
+    // false while the deadline is only the button poll
+    bool event_due = false;
+
+    if (location_marquee.is_scrolling()) {
+        other = location_marquee.next_deadline();
+        if ((long) (other - deadline) < 0) {
+            deadline = other;
+            event_due = true;
+        };
+    };
+    if (state.next_scheduled_deadline(&other) && (long) (other - deadline) < 0) {
+        deadline = other;
+        event_due = true;
+    };
+    if (button_presses_disabled() && (long) (input_available_after - deadline) < 0) {
+        deadline = input_available_after;
+        event_due = true;
+    };
+
+    if ((long) (deadline - now) <= 0) {
+        return;
+    };
+
+    unsigned long sleep_start = micros();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while ((long) (millis() - deadline) < 0 && !Serial.available()) {
+        sleep_enable();
+        sleep_cpu();
+        sleep_disable();
+    };
+    unsigned long slept_us = micros() - sleep_start;
+
+    WakeCause cause;
+    if (Serial.available()) {
+        cause = WAKE_SERIAL;
+    } else if (event_due) {
+        cause = WAKE_DEADLINE;
+    } else {
+        cause = WAKE_POLL;
+    };
+    stats_record_sleep(cause, slept_us, loop_us);
+}
+
+// a recorded session can be replayed by sending
+// each C line back at its recorded offset
+void trace_command(char command_buffer[]) {
+    Serial.print(F("T "));
+    Serial.print(millis());
+    Serial.print(F(" C "));
+    Serial.println(command_buffer);
+}
+
+void trace_buttons(unsigned char buttons) {
+    traced_buttons = buttons;
+    Serial.print(F("T "));
+    Serial.print(millis());
+    Serial.print(F(" B "));
+    Serial.println(buttons);
+}
+
 void process_buttons(unsigned char buttons) {
 
     // dont lock input if the user has unpressed the button
@@ -161,7 +415,7 @@ void process_buttons(unsigned char buttons) {
     };
 
 
-    if (state.button_down_for(BUTTON_SELECT, 1000)) {
+    if (state.button_down_for(BUTTON_SELECT, 1000, millis())) {
         // this stops the display flashing
         // by only drawing if the display mode has changed
         if (state.display_mode != STUDENT_ID) {
@@ -173,10 +427,13 @@ void process_buttons(unsigned char buttons) {
             lcd.print(F("F223129"));
             lcd.setCursor(0, 1); // next row
             int free_sram = calculate_free_memory();
+            // worst case since boot, this is what capacity should be tuned on
+            int low_sram = calculate_min_free_memory();
 
-            lcd.print(F("FREE: "));
+            lcd.print(F("FREE:"));
             lcd.print(free_sram);
-            lcd.print('B');
+            lcd.print(F(" LOW:"));
+            lcd.print(low_sram);
             return;
         };
         return; // return here to stop other display modifications
@@ -191,10 +448,10 @@ void process_buttons(unsigned char buttons) {
         // ON DEVICES ONLY
         if (state.display_mode == ON_DEVICES) {
             state.display_mode = ALL_DEVICES;
-            display_message("ALL DEVICES", WHITE);
+            display_message(F("ALL DEVICES"), WHITE);
         } else {
             state.display_mode = ON_DEVICES;
-            display_message("ON DEVICES", GREEN);
+            display_message(F("ON DEVICES"), GREEN);
         };
 
         delay(400);
@@ -204,10 +461,10 @@ void process_buttons(unsigned char buttons) {
         // OFF DEVICES ONLY
         if (state.display_mode == OFF_DEVICES) {
             state.display_mode = ALL_DEVICES;
-            display_message("ALL DEVICES", WHITE);
+            display_message(F("ALL DEVICES"), WHITE);
         } else {
            state.display_mode = OFF_DEVICES;
-            display_message("OFF DEVICES", YELLOW);
+            display_message(F("OFF DEVICES"), YELLOW);
         }
         delay(400);
         state.is_current = false;
@@ -235,127 +492,122 @@ bool button_presses_disabled() {
 }
 
 
-void display_message(char message[], unsigned char colour) {
-    // set the scrolling text to "" to disable scrolling
-    // setting the first char to the null terminator effectively
-    // blanks out the string
-    scrolling_text[0] = 0;
+// message must be in flash e.g display_message(F("HELLO"), WHITE)
+void display_message(const __FlashStringHelper* message, unsigned char colour) {
+    // stop scrolling the location of the old device over the message
+    location_marquee.stop();
     lcd.clear();
     lcd.home();
     lcd.print(message);
     lcd.setBacklight(colour);
+    stats_record_frame();
+    stats_record_lcd_chars(strlen_P((PGM_P) message));
+}
+
+// writes str into a field of width cells
+// padding with blanks (NULL_CHAR) after the null terminator
+void write_field(const char* str, NUMBER width) {
+    NUMBER i = 0;
+    for (; i < width && str[i]; i++) {
+        lcd.write(str[i]);
+    };
+    for (; i < width; i++) {
+        lcd.write((uint8_t) 0);
+    };
 }
 
-void draw_display(
-    char id[4],
-    char location[16], // 11 chars max
-    DeviceType type,
-    bool state,
-    int power,
-    DisplayFlags flags
-) {
-    char line1[17] = {0};
-    char line2[17] = {0};
+// same as write_field for strings in flash
+void write_field_P(PGM_P str, NUMBER width) {
+    NUMBER i = 0;
+    char c;
+    for (; i < width && (c = pgm_read_byte(str + i)); i++) {
+        lcd.write(c);
+    };
+    for (; i < width; i++) {
+        lcd.write((uint8_t) 0);
+    };
+}
+
+// streams the device straight from the device table to the lcd
+// rather than building line buffers on the stack first
+void draw_display(const Device* device, DisplayFlags flags) {
     // we dont need to initialise to spaces
     // because null is defined as a blank char
 
-    if (!(flags & AT_TOP)) {
-        line1[0] = 1; //UP ARROW
-    };
-    if (!(flags & AT_BOTTOM)) {
-        line2[0] = 2; //DOWN ARROW
-    }
+    lcd.home();
+
+    lcd.write((uint8_t) ((flags & AT_TOP) ? 0 : 1)); //UP ARROW
 
     //Device ID
-    strncpy(line1+1, id, 3);
+    write_field(device->id, 3);
+    lcd.write((uint8_t) 0);
 
     //Device Location
-    strncpy(line1+5, location, 11);
+    write_field(device->location, 11);
 
-    switch (type) {
-        case Speaker:
-            line2[1] = 'S';
-            break;
-        case Socket:
-            line2[1] = 'O';
-            break;
-        case Light:
-            line2[1] = 'L';
-            break;
-        case Thermostat:
-            line2[1] = 'T';
-            break;
-        case Camera:
-            line2[1] = 'C';
-            break;
-    };
+    lcd.setCursor(0, 1);
+
+    lcd.write((uint8_t) ((flags & AT_BOTTOM) ? 0 : 2)); //DOWN ARROW
+
+    lcd.write((uint8_t) device_type_to_char(device->type));
+    lcd.write((uint8_t) 0);
 
-    if (state) {
-        strncpy(line2+3, " ON", 3);
+    if (device->state) {
+        write_field_P(PSTR(" ON"), 3);
         lcd.setBacklight(GREEN); //GREEN
     } else {
-        strncpy(line2+3, "OFF", 3);
+        write_field_P(PSTR("OFF"), 3);
         lcd.setBacklight(YELLOW); //YELLOW
     };
+    lcd.write((uint8_t) 0);
 
+    char power_buf[5] = {0};
     if (flags & DISPLAY_POWER) {
-        char power_buf[4] = {0};
-
-        switch (type) {
+        switch (device->type) {
             case Speaker:
             case Light:
-                fill_char_with_int(power_buf, power, 3);
+                fill_char_with_int(power_buf, device->power, 3);
                 power_buf[3] = '%';
                 break;
             case Thermostat:
-                fill_char_with_int(power_buf, power, 2);
+                fill_char_with_int(power_buf, device->power, 2);
                 power_buf[2] = 3; // degree
                 power_buf[3] = 'C';
                 break;
+            default:
+                break;
         };
-        strncpy(line2+7, power_buf, 4);
-    };
-
-  
-    //Copy buffers to display
-
-    lcd.home();
-
-    for (NUMBER i = 0; i < 16; i++) {
-      lcd.write(line1[i]);
     };
+    // pad the rest of the line as well
+    write_field(power_buf, 9);
 
-    lcd.setCursor(0, 1);
-
-    for (NUMBER i = 0; i < 16; i++) {
-      lcd.write(line2[i]);
-    };
-    scrolling_index = 0;
-    strncpy(scrolling_text, location, 15);
+    stats_record_frame();
+    stats_record_lcd_chars(32);
+    location_marquee.start(device->location, millis());
 }
 
 void update_display(unsigned char button_state) {
 
     // if button up and not at top go to the previous device
     if (button_state & BUTTON_UP && !(current_display_flags & AT_TOP) && !button_presses_disabled()) {
-        Device device;
+        const Device* device;
         DisplayFlags flags = state.prev_device(&device);
         
         if (flags != NO_DEVICES) {
             current_display_flags = flags;
-            draw_display(device.id, device.location, device.type, device.state, device.power, flags);
+            draw_display(device, flags);
         };
         lock_buttons_for(150);
 
 
     // if button down and not at bottom go to the next device
     } else if (button_state & BUTTON_DOWN && !(current_display_flags & AT_BOTTOM) && !button_presses_disabled()) {
-        Device device;
+        const Device* device;
         DisplayFlags flags = state.next_device(&device);
         
         if (flags != NO_DEVICES) {
             current_display_flags = flags;
-            draw_display(device.id, device.location, device.type, device.state, device.power, flags);
+            draw_display(device, flags);
         };
         lock_buttons_for(150);
     
@@ -363,21 +615,23 @@ void update_display(unsigned char button_state) {
     } else if (!state.is_current) {
         lcd.clear();
         lcd.setBacklight(WHITE);
-        Device device;
+        // the device we were scrolling may have just been removed
+        location_marquee.stop();
+        const Device* device;
         DisplayFlags flags = state.current_device(&device);
         
         // if there is a device to draw
         if (flags != NO_DEVICES) {
             current_display_flags = flags;
-            draw_display(device.id, device.location, device.type, device.state, device.power, flags);
+            draw_display(device, flags);
         }
         // if there are no devices but we are in on only mode
         else if (state.display_mode == ON_DEVICES) {
-            display_message("NOTHINGS ON", GREEN);
+            display_message(F("NOTHINGS ON"), GREEN);
         }
         // if there are no devices and we are in off only mode
         else if (state.display_mode == OFF_DEVICES) {
-            display_message("NOTHINGS OFF", YELLOW);
+            display_message(F("NOTHINGS OFF"), YELLOW);
         };
     } else {
         scroll_display_text();
@@ -401,37 +655,9 @@ void update_display(unsigned char button_state) {
 };
 
 void scroll_display_text() {
-    if (millis() < next_scroll_update) {
-        return;
-    };
-    dont_scroll_until(500); // 2chars a second
-
-    NUMBER len = strlen(scrolling_text);
-
-    NUMBER scrollable = len - 11+4; // we can fit 11 chars on screen and have 4 blanks at the end
- 
-    if (len <= 11) {
-        return; // no need to scroll if fits
+    unsigned NUMBER cells = location_marquee.tick(&lcd, millis());
+    if (cells) {
+        stats_record_frame();
+        stats_record_lcd_chars(cells);
     };
-
-    if (scrolling_index > scrollable) {
-        dont_scroll_until(2000); // wait before start again
-        scrolling_index = 0;
-    };
-
-    // print with the offset as an index
-    lcd.setCursor(5, 0);
-    for (NUMBER i = 0; i < len; i++) {
-        // dont scroll after null terminator
-        if (scrolling_text[i] == 0) {
-            break;
-        };
-        lcd.write(scrolling_text[scrolling_index + i]);
-    }
-
-    scrolling_index++;
-};
-
-void dont_scroll_until(int duration) {
-    next_scroll_update = millis() + duration;
-}
\ No newline at end of file
+}
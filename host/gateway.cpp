@@ -0,0 +1,467 @@
+#include "gateway.h"
+
+#include "../errors.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+// SINKS
+
+FdReplySink::FdReplySink(int fd, bool owned) {
+    this->fd = fd;
+    this->owned = owned;
+};
+
+FdReplySink::~FdReplySink() {
+    if (this->owned) {
+        close(this->fd);
+    };
+};
+
+void FdReplySink::send(const std::string& reply) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    const char* p = reply.data();
+    size_t left = reply.size();
+    while (left) {
+        ssize_t n = ::write(this->fd, p, left);
+        if (n <= 0) {
+            return; // the other end has gone, nothing to tell
+        };
+        p += n;
+        left -= n;
+    };
+};
+
+size_t ReplyBuffer::write(uint8_t c) {
+    this->text.push_back(c);
+    return 1;
+};
+
+// HOMES
+
+Home::Home(const std::string& id, unsigned int owner) {
+    this->id = id;
+    this->owner = owner;
+    this->queued = false;
+    this->armed = false;
+    this->deadline = 0;
+    this->tick_pending = false;
+    this->state.use_output(&this->output);
+};
+
+bool valid_home_id(const std::string& id) {
+    if (id.empty() || id.size() > GATEWAY_MAX_HOME_ID) {
+        return false;
+    };
+    for (char c : id) {
+        if (!isalnum((unsigned char) c) && c != '_' && c != '-') {
+            return false;
+        };
+    };
+    return true;
+};
+
+bool split_gateway_line(const std::string& line, std::string* home, std::string* command) {
+    size_t end = line.size();
+    while (end && (line[end - 1] == '\r' || line[end - 1] == '\n')) {
+        end--;
+    };
+
+    size_t space = line.find(' ');
+    if (space == std::string::npos || space == 0 || space + 1 >= end) {
+        return false;
+    };
+    *home = line.substr(0, space);
+    *command = line.substr(space + 1, end - space - 1);
+    return valid_home_id(*home);
+};
+
+// GATEWAY
+
+Gateway::Gateway(unsigned int workers, bool pin_threads) {
+    if (!workers) {
+        workers = 1;
+    };
+    for (unsigned int i = 0; i < workers; i++) {
+        Worker* worker = new Worker();
+        worker->commands = 0;
+        worker->ticks = 0;
+        worker->steals = 0;
+        worker->scheduled_errors = 0;
+        this->workers.push_back(std::unique_ptr<Worker>(worker));
+    };
+    this->pin_threads = pin_threads;
+    this->store_size = 0;
+    this->runnable = 0;
+    this->in_flight = 0;
+    this->parked = 0;
+    this->running = false;
+    this->stopping = false;
+    this->tick_ms = 10;
+    this->started = std::chrono::steady_clock::now();
+};
+
+Gateway::~Gateway() {
+    this->stop();
+};
+
+void Gateway::use_store(const std::string& dir, unsigned int size) {
+    this->store_dir = dir;
+    this->store_size = size;
+};
+
+// starts at 1 as buttons_down_since uses 0 for not pressed
+unsigned long Gateway::now() {
+    auto elapsed = std::chrono::steady_clock::now() - this->started;
+    return 1 + (unsigned long) std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+};
+
+unsigned int Gateway::worker_count() {
+    return this->workers.size();
+};
+
+// the shard a home belongs to, fixed for the life of the process
+unsigned int Gateway::owner_of(const std::string& id) {
+    return std::hash<std::string>()(id) % this->workers.size();
+};
+
+// the stripe lock only covers the map, opening and loading the store
+// happens after so a slow disk doesnt hold up the other homes in the stripe
+// anyone else asking for the same new home waits in call_once
+Home* Gateway::home(const std::string& id) {
+    size_t hash = std::hash<std::string>()(id);
+    Stripe* stripe = &this->stripes[(hash / this->workers.size()) % GATEWAY_HOME_STRIPES];
+
+    Home* home;
+    {
+        std::lock_guard<std::mutex> guard(stripe->lock);
+        std::unique_ptr<Home>& slot = stripe->homes[id];
+        if (!slot) {
+            slot.reset(new Home(id, hash % this->workers.size()));
+        };
+        home = slot.get();
+    };
+
+    std::call_once(home->opened, &Gateway::open_store, this, home);
+    return home;
+};
+
+void Gateway::open_store(Home* home) {
+    // split_gateway_line already turns these away, this is for other callers
+    if (this->store_dir.empty() || !valid_home_id(home->id)) {
+        return;
+    };
+    std::string path = this->store_dir + "/" + home->id + ".home";
+    home->storage.reset(new MappedFileStorage(path.c_str(), this->store_size));
+    if (home->storage->is_open()) {
+        home->state.use_storage(home->storage.get());
+        home->state.read_devices_from_storage();
+    };
+};
+
+void Gateway::submit(const std::string& id, const std::string& command, std::shared_ptr<ReplySink> sink) {
+    this->submit(this->home(id), command, sink);
+};
+
+void Gateway::submit(Home* home, const std::string& command, std::shared_ptr<ReplySink> sink) {
+    this->in_flight++;
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> guard(home->inbox_lock);
+        home->inbox.push_back(Message{command, sink});
+        wake = !home->queued;
+        home->queued = true;
+    };
+
+    if (wake) {
+        this->enqueue(home, home->owner);
+    };
+};
+
+// back onto its owner's queue, wherever it last ran
+void Gateway::enqueue(Home* home, unsigned int worker) {
+    {
+        std::lock_guard<std::mutex> guard(this->workers[worker]->lock);
+        this->workers[worker]->runnable.push_back(home);
+    };
+    this->runnable++;
+
+    // only touch the park lock when someone is actually asleep
+    if (this->parked.load()) {
+        std::lock_guard<std::mutex> guard(this->park_lock);
+        this->park.notify_one();
+    };
+};
+
+// own queue from the front, otherwise steal from the back of another
+// try_lock so thieves never hold up an owner that is busy
+Home* Gateway::take(unsigned int self) {
+    Worker* own = this->workers[self].get();
+    {
+        std::lock_guard<std::mutex> guard(own->lock);
+        if (!own->runnable.empty()) {
+            Home* home = own->runnable.front();
+            own->runnable.pop_front();
+            this->runnable--;
+            return home;
+        };
+    };
+
+    unsigned int count = this->workers.size();
+    for (unsigned int i = 1; i < count; i++) {
+        Worker* victim = this->workers[(self + i) % count].get();
+        std::unique_lock<std::mutex> guard(victim->lock, std::try_to_lock);
+        if (!guard.owns_lock() || victim->runnable.empty()) {
+            continue;
+        };
+        Home* home = victim->runnable.back();
+        victim->runnable.pop_back();
+        this->runnable--;
+        own->steals.fetch_add(1, std::memory_order_relaxed);
+        return home;
+    };
+    return NULL;
+};
+
+// the nth cpu the process is allowed on (wrapping), not the nth cpu
+// of the machine, so taskset and cgroup limits are kept to
+// left unpinned if the mask cant be read
+static void pin_to_cpu(unsigned int n) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof allowed, &allowed) != 0) {
+        return;
+    };
+    int count = CPU_COUNT(&allowed);
+    if (count <= 0) {
+        return;
+    };
+
+    n %= count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        };
+        if (n--) {
+            continue;
+        };
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+        return;
+    };
+};
+
+void Gateway::run_worker(unsigned int self) {
+    if (this->pin_threads) {
+        pin_to_cpu(self);
+    };
+
+    while (true) {
+        Home* home = this->take(self);
+        if (home) {
+            this->run_home(home, self);
+            continue;
+        };
+
+        // a victim may have been locked when we looked, so only park
+        // when nothing at all is waiting
+        if (this->runnable.load() > 0) {
+            std::this_thread::yield();
+            continue;
+        };
+
+        std::unique_lock<std::mutex> guard(this->park_lock);
+        this->parked++;
+        this->park.wait(guard, [this] {
+            return this->runnable.load() > 0 || this->stopping.load();
+        });
+        this->parked--;
+        if (this->stopping.load() && this->runnable.load() <= 0) {
+            return;
+        };
+    };
+};
+
+// everything in the inbox runs before the home is let go
+// so no other worker can see it half way through
+void Gateway::run_home(Home* home, unsigned int self) {
+    std::deque<Message> batch;
+    {
+        std::lock_guard<std::mutex> guard(home->inbox_lock);
+        batch.swap(home->inbox);
+    };
+
+    unsigned long now = this->now();
+    for (const Message& message : batch) {
+        this->execute(home, message, now);
+        if (message.command.empty()) {
+            this->workers[self]->ticks.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            this->workers[self]->commands.fetch_add(1, std::memory_order_relaxed);
+        };
+    };
+    this->rearm(home);
+
+    bool more;
+    {
+        std::lock_guard<std::mutex> guard(home->inbox_lock);
+        more = !home->inbox.empty();
+        home->queued = more;
+    };
+    if (more) {
+        this->enqueue(home, home->owner);
+    };
+
+    this->in_flight -= batch.size();
+};
+
+// same as the sketch, K, C<hresult> or E<hresult>
+// anything a command prints (SYNC) goes first, a line at a time
+void Gateway::execute(Home* home, const Message& message, unsigned long now) {
+    if (message.command.empty()) {
+        home->tick_pending = false;
+        HRESULT hresult;
+        while (home->state.run_next_scheduled(now, &hresult)) {
+            if (hresult != S_OK) {
+                this->workers[home->owner]->scheduled_errors.fetch_add(1, std::memory_order_relaxed);
+            };
+        };
+        return;
+    };
+
+    // the longest valid command is 23 chars, the rest is dropped like on the hub
+    char command_buffer[24] = {0};
+    strncpy(command_buffer, message.command.c_str(), 23);
+
+    Command command;
+    HRESULT hresult = Command::create(command_buffer, &command);
+    char code = 'C';
+    if (hresult == S_OK) {
+        code = 'E';
+        // the hub commands (STATS, TRACE ...) belong to the sketch
+        if (command.is_hub_command()) {
+            hresult = E_COMMAND_NOT_A_COMMAND;
+        } else {
+            hresult = command.execute(&home->state, command_buffer, now);
+        };
+    };
+
+    if (!message.sink) {
+        home->output.text.clear();
+        return;
+    };
+
+    std::string reply;
+    size_t start = 0;
+    const std::string& text = home->output.text;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        };
+        size_t len = end - start;
+        if (len && text[start + len - 1] == '\r') {
+            len--;
+        };
+        reply += home->id;
+        reply += ' ';
+        reply.append(text, start, len);
+        reply += '\n';
+        start = end + 1;
+    };
+    home->output.text.clear();
+
+    reply += home->id;
+    reply += ' ';
+    if (hresult == S_OK) {
+        reply += 'K';
+    } else {
+        reply += code;
+        reply += std::to_string((int) hresult);
+    };
+    reply += '\n';
+    message.sink->send(reply);
+};
+
+// the ticker only reads these, the home itself is never touched off its worker
+void Gateway::rearm(Home* home) {
+    unsigned long deadline;
+    bool armed = home->state.next_scheduled_deadline(&deadline);
+    home->deadline = deadline;
+    home->armed = armed;
+};
+
+void Gateway::run_ticker() {
+    while (!this->stopping.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(this->tick_ms));
+        unsigned long now = this->now();
+
+        for (Stripe& stripe : this->stripes) {
+            std::lock_guard<std::mutex> guard(stripe.lock);
+            for (auto& entry : stripe.homes) {
+                Home* home = entry.second.get();
+                // signed difference so this survives the clock wrapping
+                if (!home->armed.load() || (long) (now - home->deadline.load()) < 0) {
+                    continue;
+                };
+                if (home->tick_pending.exchange(true)) {
+                    continue;
+                };
+                this->submit(home, std::string(), std::shared_ptr<ReplySink>());
+            };
+        };
+    };
+};
+
+void Gateway::start(unsigned int tick_ms) {
+    if (this->running.exchange(true)) {
+        return;
+    };
+    this->tick_ms = tick_ms;
+    for (unsigned int i = 0; i < this->workers.size(); i++) {
+        this->workers[i]->thread = std::thread(&Gateway::run_worker, this, i);
+    };
+    if (tick_ms) {
+        this->ticker = std::thread(&Gateway::run_ticker, this);
+    };
+};
+
+void Gateway::drain() {
+    while (this->in_flight.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    };
+};
+
+void Gateway::stop() {
+    if (!this->running.exchange(false)) {
+        return;
+    };
+    {
+        std::lock_guard<std::mutex> guard(this->park_lock);
+        this->stopping = true;
+        this->park.notify_all();
+    };
+    for (auto& worker : this->workers) {
+        worker->thread.join();
+    };
+    if (this->ticker.joinable()) {
+        this->ticker.join();
+    };
+};
+
+GatewayCounters Gateway::counters() {
+    GatewayCounters counters = {0, 0, 0, 0};
+    for (auto& worker : this->workers) {
+        counters.commands += worker->commands.load();
+        counters.ticks += worker->ticks.load();
+        counters.steals += worker->steals.load();
+        counters.scheduled_errors += worker->scheduled_errors.load();
+    };
+    return counters;
+};
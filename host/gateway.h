@@ -0,0 +1,181 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+// many homes in one linux process
+// each home is a SmartHomeState owned by one worker thread (its shard)
+// a home with work waiting sits in its owner's run queue, an idle worker
+// steals homes from the back of other queues, a home is only ever in one
+// queue so its commands still run one at a time and in order
+
+#include <Arduino.h>
+
+#include "../command.h"
+#include "../mapped_file_storage.h"
+#include "../util.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// homes are looked up under one of several locks
+// so input threads dont all queue on the same one
+#define GATEWAY_HOME_STRIPES 16
+
+// home ids name the store file so they are kept to [A-Za-z0-9_-]
+#define GATEWAY_MAX_HOME_ID 64
+
+// where the replies for a command go
+// send is called from any worker so it must be thread safe
+class ReplySink {
+    public:
+        virtual ~ReplySink() {};
+        virtual void send(const std::string&) = 0;
+};
+
+// a file descriptor (stdout, a socket connection)
+// writes are whole replies so lines from different homes dont interleave
+// an owned fd is closed with the sink, which is once the connection
+// has been read to the end and the last reply queued for it has gone
+class FdReplySink : public ReplySink {
+    private:
+        int fd;
+        bool owned;
+        std::mutex lock;
+
+    public:
+        FdReplySink(int, bool owned = false);
+        ~FdReplySink();
+        void send(const std::string&);
+};
+
+// SYNC output for one home, collected until the command finishes
+class ReplyBuffer : public Print {
+    public:
+        std::string text;
+        size_t write(uint8_t);
+        using Print::write;
+};
+
+// an empty command is a scheduler tick
+struct Message {
+    std::string command;
+    std::shared_ptr<ReplySink> sink;
+};
+
+struct Home {
+    Home(const std::string&, unsigned int);
+
+    std::string id;
+    unsigned int owner;
+    SmartHomeState state;
+    ReplyBuffer output;
+    std::unique_ptr<MappedFileStorage> storage;
+    std::once_flag opened; // the store is loaded once, outside the stripe lock
+
+    // guarded by inbox_lock
+    std::mutex inbox_lock;
+    std::deque<Message> inbox;
+    bool queued; // in some worker's run queue
+
+    // read by the ticker without taking the home
+    std::atomic<bool> armed;
+    std::atomic<unsigned long> deadline;
+    std::atomic<bool> tick_pending;
+};
+
+struct GatewayCounters {
+    unsigned long long commands;
+    unsigned long long ticks;
+    unsigned long long steals;
+    unsigned long long scheduled_errors;
+};
+
+class Gateway {
+    private:
+        struct Worker {
+            std::mutex lock;
+            std::deque<Home*> runnable;
+            std::thread thread;
+            std::atomic<unsigned long long> commands;
+            std::atomic<unsigned long long> ticks;
+            std::atomic<unsigned long long> steals;
+            std::atomic<unsigned long long> scheduled_errors;
+        };
+
+        struct Stripe {
+            std::mutex lock;
+            std::unordered_map<std::string, std::unique_ptr<Home>> homes;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        Stripe stripes[GATEWAY_HOME_STRIPES];
+        bool pin_threads;
+        std::string store_dir;
+        unsigned int store_size;
+
+        // homes sitting in run queues, idle workers park until it is non zero
+        std::atomic<long> runnable;
+        std::atomic<long> in_flight; // submitted but not finished
+        std::atomic<int> parked;
+        std::mutex park_lock;
+        std::condition_variable park;
+
+        std::atomic<bool> running;
+        std::atomic<bool> stopping;
+        std::thread ticker;
+        unsigned int tick_ms;
+        std::chrono::steady_clock::time_point started;
+
+        void enqueue(Home*, unsigned int);
+        Home* take(unsigned int);
+        void run_worker(unsigned int);
+        void run_home(Home*, unsigned int);
+        void execute(Home*, const Message&, unsigned long);
+        void run_ticker();
+        void rearm(Home*);
+        void open_store(Home*);
+
+    public:
+        Gateway(unsigned int workers, bool pin_threads = true);
+        ~Gateway();
+
+        // give every home a MappedFileStorage in dir (one file each)
+        // must be called before the first home is created
+        void use_store(const std::string&, unsigned int);
+
+        // ms since the gateway was created, what every home sees as millis()
+        unsigned long now();
+
+        // finds or creates the home, the id must pass valid_home_id
+        // or it is kept in memory only
+        Home* home(const std::string&);
+        unsigned int owner_of(const std::string&);
+
+        void submit(Home*, const std::string&, std::shared_ptr<ReplySink>);
+        void submit(const std::string&, const std::string&, std::shared_ptr<ReplySink>);
+
+        // workers can be started after submitting so a benchmark
+        // measures only the processing
+        void start(unsigned int tick_ms = 10);
+        void drain(); // wait until everything submitted has run
+        void stop();
+
+        GatewayCounters counters();
+        unsigned int worker_count();
+};
+
+// 1 to GATEWAY_MAX_HOME_ID of [A-Za-z0-9_-], nothing that could leave the store dir
+bool valid_home_id(const std::string&);
+
+// "<home> <command>" into its parts
+// false if there is no command or the home id isnt valid
+bool split_gateway_line(const std::string&, std::string*, std::string*);
+
+#endif
@@ -0,0 +1,163 @@
+// gateway_bench [-h HOMES] [-c COMMANDS_PER_HOME] [-t MAX_THREADS] [--hot]
+//
+// commands/sec through the gateway at 1, 2, 4 ... MAX_THREADS workers
+// every run queues the same commands before the workers start
+// so only the processing is timed, not reading them in
+// --hot sends 90% of the traffic to the homes of one shard
+// which only gets spread out by stealing
+
+#include "gateway.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// counts replies instead of printing them
+class CountingSink : public ReplySink {
+    public:
+        std::atomic<unsigned long long> replies;
+        std::atomic<unsigned long long> errors;
+        CountingSink() {
+            this->replies = 0;
+            this->errors = 0;
+        };
+        void send(const std::string& reply) {
+            this->replies++;
+            // the status is always the last line
+            size_t last = reply.rfind(' ', reply.size() - 2);
+            if (reply[last + 1] != 'K') {
+                this->errors++;
+            };
+        };
+};
+
+static const char* DEVICE_IDS[] = {"LIG", "SPK", "THR", "SOC", "CAM"};
+#define NUM_DEVICE_IDS 5
+
+// what a busy home sends, cycled through per home
+static std::string command_for(unsigned int n) {
+    char buf[32];
+    const char* id = DEVICE_IDS[n % NUM_DEVICE_IDS];
+    switch ((n / NUM_DEVICE_IDS) % 6) {
+        case 0:
+            snprintf(buf, sizeof buf, "S-%s-%s", id, (n & 1) ? "ON" : "OFF");
+            break;
+        case 1:
+            // CAM and SOC have no power so some of these are rejected
+            snprintf(buf, sizeof buf, "P-%s-%d", id, id[0] == 'T' ? 9 + n % 20 : n % 100);
+            break;
+        case 2:
+            snprintf(buf, sizeof buf, "D-%s-%u-ON", id, 60 + n % 60);
+            break;
+        case 3:
+            snprintf(buf, sizeof buf, "SYNC-0-%u", n % 50);
+            break;
+        case 4:
+            snprintf(buf, sizeof buf, "S-%s-ON", id);
+            break;
+        default:
+            snprintf(buf, sizeof buf, "D-%s", id);
+            break;
+    };
+    return buf;
+};
+
+static void add_devices(Gateway* gateway, Home* home, std::shared_ptr<ReplySink> sink) {
+    gateway->submit(home, "A-LIG-L-Kitchen", sink);
+    gateway->submit(home, "A-SPK-S-Lounge", sink);
+    gateway->submit(home, "A-THR-T-Hall", sink);
+    gateway->submit(home, "A-SOC-O-Garage", sink);
+    gateway->submit(home, "A-CAM-C-Porch", sink);
+};
+
+static std::string home_name(unsigned int i) {
+    char buf[16];
+    snprintf(buf, sizeof buf, "home%05u", i);
+    return buf;
+};
+
+static void run(unsigned int threads, unsigned int homes, unsigned int per_home, bool hot) {
+    Gateway gateway(threads);
+    std::shared_ptr<CountingSink> sink(new CountingSink());
+
+    std::vector<Home*> all;
+    std::vector<Home*> shard0;
+    for (unsigned int i = 0; i < homes; i++) {
+        Home* home = gateway.home(home_name(i));
+        all.push_back(home);
+        if (home->owner == 0) {
+            shard0.push_back(home);
+        };
+        add_devices(&gateway, home, sink);
+    };
+    if (shard0.empty()) {
+        shard0.push_back(all[0]);
+    };
+
+    // interleaved across homes like real traffic
+    unsigned long long total = (unsigned long long) homes * per_home;
+    for (unsigned long long n = 0; n < total; n++) {
+        Home* home;
+        if (hot && n % 10) {
+            home = shard0[(n / 10) % shard0.size()];
+        } else {
+            home = all[n % homes];
+        };
+        gateway.submit(home, command_for(n / homes + n), sink);
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    gateway.start(0);
+    gateway.drain();
+    auto end = std::chrono::steady_clock::now();
+    gateway.stop();
+
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    GatewayCounters counters = gateway.counters();
+    printf("%7u %12.0f %10.3f %10llu %10llu\n",
+        threads,
+        counters.commands / seconds,
+        seconds,
+        counters.steals,
+        (unsigned long long) sink->errors.load());
+};
+
+int main(int argc, char** argv) {
+    unsigned int homes = 4096;
+    unsigned int per_home = 200;
+    unsigned int max_threads = std::thread::hardware_concurrency();
+    bool hot = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+            homes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            per_home = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hot") == 0) {
+            hot = true;
+        } else {
+            fprintf(stderr, "usage: gateway_bench [-h HOMES] [-c COMMANDS_PER_HOME] [-t MAX_THREADS] [--hot]\n");
+            return 2;
+        };
+    };
+    if (!homes || !max_threads) {
+        return 2;
+    };
+
+    printf("homes=%u commands=%llu%s\n", homes, (unsigned long long) homes * per_home, hot ? " hot" : "");
+    printf("threads       cmds/s    seconds     steals   rejected\n");
+    for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+        run(threads, homes, per_home, hot);
+        if (threads < max_threads && threads * 2 > max_threads) {
+            run(max_threads, homes, per_home, hot);
+        };
+    };
+    return 0;
+};
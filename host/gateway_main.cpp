@@ -0,0 +1,164 @@
+// gateway [-t THREADS] [--no-pin] [--store DIR] [--socket PATH]
+//
+// reads "<home> <command>" lines (the hub's own grammar after the home)
+// and replies "<home> <reply>" for every line the hub would have sent
+// from stdin to stdout, or from every connection to a unix socket
+// back to that same connection
+
+#include "gateway.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// a store file per home, room for the full device table and the boot epoch
+#define GATEWAY_STORE_SIZE 4096
+
+// longest wait between accept retries when out of fds
+#define ACCEPT_MAX_BACKOFF_MS 1000
+
+static void usage() {
+    fprintf(stderr, "usage: gateway [-t THREADS] [--no-pin] [--store DIR] [--socket PATH]\n");
+    exit(2);
+};
+
+static void serve_connection(Gateway* gateway, int fd) {
+    std::shared_ptr<ReplySink> sink(new FdReplySink(fd, true));
+    std::string pending;
+    char buf[4096];
+
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof buf);
+        if (n <= 0) {
+            break;
+        };
+        pending.append(buf, n);
+
+        size_t start = 0;
+        size_t end;
+        while ((end = pending.find('\n', start)) != std::string::npos) {
+            std::string home, command;
+            if (split_gateway_line(pending.substr(start, end - start), &home, &command)) {
+                gateway->submit(home, command, sink);
+            };
+            start = end + 1;
+        };
+        pending.erase(0, start);
+    };
+
+    // replies still queued hold the sink so the fd stays open
+    // until they have gone out, the last one closes it
+};
+
+static int serve_socket(Gateway* gateway, const char* path) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    };
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof address.sun_path) {
+        fprintf(stderr, "socket path too long\n");
+        return 1;
+    };
+    strcpy(address.sun_path, path);
+    unlink(path);
+
+    if (bind(listener, (struct sockaddr*) &address, sizeof address) != 0 || listen(listener, 64) != 0) {
+        perror(path);
+        return 1;
+    };
+
+    unsigned int backoff_ms = 0;
+    while (true) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd >= 0) {
+            backoff_ms = 0;
+            std::thread(serve_connection, gateway, fd).detach();
+            continue;
+        };
+
+        switch (errno) {
+            case EINTR:
+            case ECONNABORTED:
+                // that one connection, not the listener
+                continue;
+            case EMFILE:
+            case ENFILE:
+            case ENOBUFS:
+            case ENOMEM:
+                // out of fds or memory until connections close
+                // so wait for that instead of spinning on accept
+                if (!backoff_ms) {
+                    perror("accept");
+                };
+                backoff_ms = backoff_ms ? backoff_ms * 2 : 10;
+                if (backoff_ms > ACCEPT_MAX_BACKOFF_MS) {
+                    backoff_ms = ACCEPT_MAX_BACKOFF_MS;
+                };
+                std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+                continue;
+            default:
+                perror("accept");
+                return 1;
+        };
+    };
+};
+
+static void serve_stdin(Gateway* gateway) {
+    std::shared_ptr<ReplySink> sink(new FdReplySink(STDOUT_FILENO));
+    std::string line, home, command;
+
+    while (std::getline(std::cin, line)) {
+        if (split_gateway_line(line, &home, &command)) {
+            gateway->submit(home, command, sink);
+        };
+    };
+    gateway->drain();
+};
+
+int main(int argc, char** argv) {
+    unsigned int threads = std::thread::hardware_concurrency();
+    bool pin = true;
+    const char* socket_path = NULL;
+    const char* store = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-pin") == 0) {
+            pin = false;
+        } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            store = argv[++i];
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else {
+            usage();
+        };
+    };
+
+    Gateway gateway(threads, pin);
+    if (store) {
+        gateway.use_store(store, GATEWAY_STORE_SIZE);
+    };
+    gateway.start();
+
+    if (socket_path) {
+        return serve_socket(&gateway, socket_path);
+    };
+    serve_stdin(&gateway);
+    gateway.stop();
+    return 0;
+};
@@ -0,0 +1,347 @@
+// replay [--baseline FILE] [--write-baseline FILE] [-v] TRACE
+//
+// runs the sketch itself (setup() then loop()) against the stubs and
+// feeds it a session in the format TRACE records, as fast as the host can go
+//   T <ms> C <command>    sent to the serial port at ms
+//   T <ms> B <bitmask>    buttons held from ms
+// any other line is ignored so a raw serial log can be replayed as is
+//
+// time is simulated so everything but the host timings is the same on
+// every run, those are what the baseline is strict about
+
+#include <Arduino.h>
+#include <Adafruit_RGBLCDShield.h>
+#include <EEPROM.h>
+
+#include "../util.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void setup();
+void loop();
+
+struct TraceEvent {
+    unsigned long ms;
+    bool is_command;
+    std::string command;
+    uint8_t buttons;
+};
+
+static std::vector<TraceEvent> events;
+static size_t next_event = 0;
+static unsigned long long replay_start_us = 0;
+static unsigned long first_ms = 0;
+
+static bool verbose = false;
+static std::string serial_out;
+
+static unsigned long long event_us(const TraceEvent& event) {
+    return replay_start_us + (event.ms - first_ms) * 1000ull;
+};
+
+// a command is only sent once the sketch has taken the last one
+// otherwise two would arrive as one read, like they would on the board
+static void deliver_due() {
+    while (next_event < events.size() && event_us(events[next_event]) <= host_clock_us()) {
+        const TraceEvent& event = events[next_event];
+        if (event.is_command) {
+            if (host_serial_rx_pending()) {
+                return;
+            };
+            host_serial_feed(event.command.data(), event.command.size());
+        } else {
+            host_lcd_buttons = event.buttons;
+        };
+        next_event++;
+    };
+};
+
+static void collect_serial() {
+    char buf[256];
+    size_t n;
+    while ((n = host_serial_take(buf, sizeof buf))) {
+        serial_out.append(buf, n);
+        if (verbose) {
+            fwrite(buf, 1, n, stdout);
+        };
+    };
+};
+
+static bool load_trace(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    };
+
+    char line[128];
+    while (fgets(line, sizeof line, f)) {
+        line[strcspn(line, "\r\n")] = 0;
+
+        unsigned long ms;
+        char kind;
+        int offset;
+        if (sscanf(line, "T %lu %c %n", &ms, &kind, &offset) != 2) {
+            continue;
+        };
+
+        TraceEvent event;
+        event.ms = ms;
+        event.buttons = 0;
+        if (kind == 'C') {
+            event.is_command = true;
+            event.command = line + offset;
+        } else if (kind == 'B') {
+            event.is_command = false;
+            event.buttons = strtoul(line + offset, NULL, 10);
+        } else {
+            continue;
+        };
+        events.push_back(event);
+    };
+    fclose(f);
+
+    if (events.empty()) {
+        fprintf(stderr, "%s: no T lines\n", path);
+        return false;
+    };
+    first_ms = events[0].ms;
+    return true;
+};
+
+// the last value on the line of STATS output that starts with prefix
+static unsigned long stat(const char* prefix, const char* key) {
+    size_t line = serial_out.rfind(prefix);
+    if (line == std::string::npos) {
+        return 0;
+    };
+    size_t end = serial_out.find('\n', line);
+    size_t at = serial_out.find(key, line);
+    if (at == std::string::npos || at > end) {
+        return 0;
+    };
+    return strtoul(serial_out.c_str() + at + strlen(key), NULL, 10);
+};
+
+// lines that are just the code, or the code and an hresult
+static unsigned long count_replies(char code) {
+    unsigned long count = 0;
+    size_t start = 0;
+    while (start < serial_out.size()) {
+        size_t end = serial_out.find('\n', start);
+        if (end == std::string::npos) {
+            end = serial_out.size();
+        };
+        size_t at = start + 1;
+        while (at < end && isdigit(serial_out[at])) {
+            at++;
+        };
+        if (serial_out[start] == code && (at == end || serial_out[at] == '\r')) {
+            count++;
+        };
+        start = end + 1;
+    };
+    return count;
+};
+
+// BASELINE
+// one metric a line: NAME max|min VALUE
+// max for counts that must not grow, min for rates that must not drop
+
+struct Limit {
+    bool is_max;
+    double value;
+};
+
+static bool read_baseline(const char* path, std::map<std::string, Limit>* limits) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    };
+    char line[128];
+    while (fgets(line, sizeof line, f)) {
+        char name[64];
+        char kind[8];
+        double value;
+        if (line[0] == '#' || sscanf(line, "%63s %7s %lf", name, kind, &value) != 3) {
+            continue;
+        };
+        limits->insert(std::make_pair(std::string(name), Limit{strcmp(kind, "max") == 0, value}));
+    };
+    fclose(f);
+    return true;
+};
+
+// host timings are noisy (and differ per machine) so their limits
+// are a fraction of what was measured, the simulated metrics are exact
+#define HOST_TIMING_SLACK 0.25
+
+static void write_baseline(const char* path, const std::vector<std::pair<std::string, double>>& metrics) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return;
+    };
+    fprintf(f, "# written by replay --write-baseline, checked by make check\n");
+    fprintf(f, "# NAME max|min VALUE\n");
+    for (auto& metric : metrics) {
+        // no better direction (sleeps) or too noisy to hold to (one slow pass)
+        if (metric.first == "sleeps" || metric.first == "max_command_us") {
+            continue;
+        };
+        if (metric.first == "cmds_per_sec") {
+            fprintf(f, "%s min %.0f\n", metric.first.c_str(), metric.second * HOST_TIMING_SLACK);
+        } else if (metric.first == "mean_command_us") {
+            fprintf(f, "%s max %.1f\n", metric.first.c_str(), metric.second / HOST_TIMING_SLACK);
+        } else if (metric.first == "commands" || metric.first == "ok_replies") {
+            fprintf(f, "%s min %.0f\n", metric.first.c_str(), metric.second);
+        } else {
+            fprintf(f, "%s max %.2f\n", metric.first.c_str(), metric.second);
+        };
+    };
+    fclose(f);
+};
+
+int main(int argc, char** argv) {
+    const char* trace = NULL;
+    const char* baseline = NULL;
+    const char* write_to = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            write_to = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (!trace) {
+            trace = argv[i];
+        } else {
+            trace = NULL;
+            break;
+        };
+    };
+    if (!trace) {
+        fprintf(stderr, "usage: replay [--baseline FILE] [--write-baseline FILE] [-v] TRACE\n");
+        return 2;
+    };
+    if (!load_trace(trace)) {
+        return 2;
+    };
+
+    // the host's half of the sync handshake, at 115200 baud
+    host_clock_set_us(1000);
+    host_serial_feed("XB4", 3);
+    setup();
+    collect_serial();
+    serial_out.clear();
+
+    replay_start_us = host_clock_us();
+    host_clock_hook = deliver_due;
+    unsigned long eeprom_before = EEPROM.cells_written;
+    unsigned long i2c_before = host_lcd.i2c_writes;
+    unsigned long button_reads_before = host_lcd.button_reads;
+
+    // run until the last event plus enough for anything it scheduled to settle
+    unsigned long long end_us = event_us(events.back()) + 5000000ull;
+    unsigned long commands = 0;
+    double command_us_total = 0;
+    double command_us_max = 0;
+    auto wall_start = std::chrono::steady_clock::now();
+
+    while (next_event < events.size() || host_clock_us() < end_us) {
+        deliver_due();
+        bool command_waiting = host_serial_rx_pending() >= MIN_COMMAND_LEN;
+
+        unsigned long long clock_before = host_clock_us();
+        auto start = std::chrono::steady_clock::now();
+        loop();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        if (command_waiting && !host_serial_rx_pending()) {
+            commands++;
+            command_us_total += us;
+            if (us > command_us_max) {
+                command_us_max = us;
+            };
+        };
+        collect_serial();
+
+        // every pass reads the buttons over i2c which moves the clock
+        // but dont rely on it, a pass that took no time would never end
+        if (host_clock_us() == clock_before) {
+            host_clock_advance_us(100);
+        };
+    };
+
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    // button polling is i2c too but it isnt drawing
+    unsigned long i2c_writes = host_lcd.i2c_writes - i2c_before - (host_lcd.button_reads - button_reads_before);
+    unsigned long eeprom_bytes = EEPROM.cells_written - eeprom_before;
+    unsigned long ok_replies = count_replies('K');
+
+    // the sketch's own counters for frames and what it thinks it wrote
+    host_clock_hook = NULL;
+    host_serial_feed("STATS", 5);
+    host_clock_advance_us(1000);
+    loop();
+    collect_serial();
+    unsigned long frames = stat("LCD frames=", "frames=");
+
+    std::vector<std::pair<std::string, double>> metrics;
+    metrics.push_back(std::make_pair("commands", (double) commands));
+    metrics.push_back(std::make_pair("ok_replies", (double) ok_replies));
+    metrics.push_back(std::make_pair("cmds_per_sec", commands / wall_s));
+    metrics.push_back(std::make_pair("mean_command_us", commands ? command_us_total / commands : 0));
+    metrics.push_back(std::make_pair("max_command_us", command_us_max));
+    metrics.push_back(std::make_pair("frames", (double) frames));
+    metrics.push_back(std::make_pair("i2c_writes", (double) i2c_writes));
+    metrics.push_back(std::make_pair("i2c_per_frame", frames ? (double) i2c_writes / frames : 0));
+    metrics.push_back(std::make_pair("lcd_chars", (double) stat("LCD frames=", "chars=")));
+    metrics.push_back(std::make_pair("eeprom_bytes", (double) eeprom_bytes));
+    metrics.push_back(std::make_pair("sleeps", (double) stat("IDLE loops=", "sleeps=")));
+    metrics.push_back(std::make_pair("loops", (double) stat("IDLE loops=", "loops=")));
+
+    for (auto& metric : metrics) {
+        printf("%-16s %.2f\n", metric.first.c_str(), metric.second);
+    };
+
+    if (write_to) {
+        write_baseline(write_to, metrics);
+    };
+
+    if (!baseline) {
+        return 0;
+    };
+
+    std::map<std::string, Limit> limits;
+    if (!read_baseline(baseline, &limits)) {
+        return 2;
+    };
+    bool ok = true;
+    for (auto& metric : metrics) {
+        auto found = limits.find(metric.first);
+        if (found == limits.end()) {
+            continue;
+        };
+        const Limit& limit = found->second;
+        // the 0.005 is for the 2 decimal places the baseline is written with
+        bool regressed = limit.is_max ? metric.second > limit.value + 0.005 : metric.second < limit.value - 0.005;
+        if (regressed) {
+            printf("REGRESSION %s %.2f, baseline %s %.2f\n",
+                metric.first.c_str(), metric.second, limit.is_max ? "max" : "min", limit.value);
+            ok = false;
+        };
+    };
+    printf(ok ? "baseline ok\n" : "baseline FAILED\n");
+    return ok ? 0 : 1;
+};
@@ -0,0 +1,173 @@
+// storage_bench [-n ITERATIONS] [--dir DIR]
+//
+// save and load times through each Storage backend for a few table sizes
+// every load is checked against what was saved, a mismatch exits 1
+// so this doubles as the test for the backends (make check runs it)
+//
+// the eeprom backend runs against the stubbed 1KB eeprom so its times
+// are only the scan, on the avr every changed cell costs ~3.3ms
+// so the cells column is what actually matters there
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "../eeprom_storage.h"
+#include "../mapped_file_storage.h"
+#include "../util.h"
+
+#include <chrono>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define AVR_EEPROM_WRITE_MS 3.3
+
+static const unsigned int SIZES[] = {1, 10, 20, 37, MAX_CAPACITY};
+#define NUM_SIZES (sizeof SIZES / sizeof SIZES[0])
+
+static const char TYPES[] = {'L', 'S', 'T', 'O', 'C'};
+
+// ids AAA, AAB ... so the table is filled in order
+static void fill(SmartHomeState* state, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        Device device;
+        memset(&device, 0, sizeof device);
+        device.id[0] = 'A' + i / 26 / 26 % 26;
+        device.id[1] = 'A' + i / 26 % 26;
+        device.id[2] = 'A' + i % 26;
+        device.type = char_to_device_type(TYPES[i % 5]);
+        snprintf(device.location, sizeof device.location, "Room %u", i);
+        device.state = i & 1;
+        device.power = device.type == Thermostat ? 20 : i % 100;
+        state->add_device(&device);
+    };
+};
+
+// epoch 0 never matches so every device comes back
+static bool same_devices(SmartHomeState* a, SmartHomeState* b) {
+    for (NUMBER i = 0; i < MAX_CAPACITY; i++) {
+        const Device* x = a->changed_device(i, 0, 0);
+        const Device* y = b->changed_device(i, 0, 0);
+        if (!x != !y) {
+            return false;
+        };
+        if (x && memcmp(x, y, sizeof(Device)) != 0) {
+            return false;
+        };
+    };
+    return true;
+};
+
+static double elapsed_us(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - since).count();
+};
+
+// false if a load didnt give back what was saved
+static bool run(const char* name, Storage* storage, unsigned int count, unsigned int iterations) {
+    SmartHomeState saved;
+    fill(&saved, count);
+    saved.use_storage(storage);
+
+    unsigned long cells_before = EEPROM.cells_written;
+    HRESULT hresult = S_OK;
+    double save_us = 0;
+    double load_us = 0;
+    NUMBER loaded = 0;
+    bool ok = true;
+
+    for (unsigned int i = 0; i < iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        hresult = saved.write_devices_to_storage();
+        save_us += elapsed_us(start);
+
+        SmartHomeState state;
+        state.use_storage(storage);
+        start = std::chrono::steady_clock::now();
+        loaded = state.read_devices_from_storage();
+        load_us += elapsed_us(start);
+
+        // a full store keeps the first records, everything saved must load
+        if (hresult == S_OK && !same_devices(&saved, &state)) {
+            ok = false;
+        };
+        if (hresult != S_OK && hresult != E_STATE_EEPROM_FULL) {
+            ok = false;
+        };
+    };
+
+    // the first save is the only one that changes anything
+    // later ones rewrite the same bytes (and the boot epoch)
+    printf("%-8s %7u %7d %10.2f %10.2f %8lu %s\n",
+        name,
+        count,
+        (int) loaded,
+        save_us / iterations,
+        load_us / iterations,
+        EEPROM.cells_written - cells_before,
+        hresult == E_STATE_EEPROM_FULL ? "full" : (ok ? "ok" : "MISMATCH"));
+    return ok;
+};
+
+int main(int argc, char** argv) {
+    unsigned int iterations = 1000;
+    std::string dir = "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            fprintf(stderr, "usage: storage_bench [-n ITERATIONS] [--dir DIR]\n");
+            return 2;
+        };
+    };
+    if (!iterations) {
+        iterations = 1;
+    };
+
+    bool ok = true;
+    printf("backend  devices  loaded    save_us    load_us    cells\n");
+
+    for (unsigned int i = 0; i < NUM_SIZES; i++) {
+        memset(EEPROM.cells, 0xFF, sizeof EEPROM.cells);
+        EepromStorage eeprom;
+        ok &= run("eeprom", &eeprom, SIZES[i], iterations);
+    };
+
+    // 4KB is the whole table, 64KB shows what the scan costs on a bigger store
+    const unsigned int MAPPED_SIZES[] = {4096, 65536};
+    for (unsigned int m = 0; m < 2; m++) {
+        for (unsigned int i = 0; i < NUM_SIZES; i++) {
+            std::string path = dir + "/storage_bench.map";
+            unlink(path.c_str());
+            MappedFileStorage mapped(path.c_str(), MAPPED_SIZES[m]);
+            if (!mapped.is_open()) {
+                fprintf(stderr, "cant map %s\n", path.c_str());
+                return 1;
+            };
+            char name[16];
+            snprintf(name, sizeof name, "mmap%uk", MAPPED_SIZES[m] / 1024);
+            ok &= run(name, &mapped, SIZES[i], iterations);
+            unlink(path.c_str());
+        };
+    };
+
+    // what the first save of a full eeprom would take on the board
+    memset(EEPROM.cells, 0xFF, sizeof EEPROM.cells);
+    EEPROM.cells_written = 0;
+    {
+        SmartHomeState state;
+        fill(&state, 37);
+        EepromStorage eeprom;
+        state.use_storage(&eeprom);
+        state.write_devices_to_storage();
+        printf("avr estimate: first save of 37 devices writes %lu cells, ~%.0fms\n",
+            EEPROM.cells_written, EEPROM.cells_written * AVR_EEPROM_WRITE_MS);
+    };
+
+    return ok ? 0 : 1;
+};
@@ -0,0 +1,39 @@
+#ifndef HOST_ADAFRUIT_RGBLCDSHIELD_H
+#define HOST_ADAFRUIT_RGBLCDSHIELD_H
+
+#include <Arduino.h>
+
+#define BUTTON_UP 0x08
+#define BUTTON_DOWN 0x04
+#define BUTTON_LEFT 0x10
+#define BUTTON_RIGHT 0x02
+#define BUTTON_SELECT 0x01
+
+// the real shield is an MCP23017 on i2c, this keeps the screen in memory
+// and counts the i2c transactions each call would have cost
+// (moving the simulated clock on by the time they would take)
+struct HostLcdCounters {
+    unsigned long i2c_writes;
+    unsigned long chars;
+    unsigned long button_reads;
+};
+
+class Adafruit_RGBLCDShield : public Print {
+    public:
+        Adafruit_RGBLCDShield();
+        void begin(uint8_t, uint8_t);
+        void clear();
+        void home();
+        void setCursor(uint8_t, uint8_t);
+        void setBacklight(uint8_t);
+        void createChar(uint8_t, uint8_t[]);
+        uint8_t readButtons();
+        size_t write(uint8_t);
+        using Print::write;
+};
+
+extern HostLcdCounters host_lcd;
+extern char host_lcd_screen[2][17];
+extern uint8_t host_lcd_buttons; // what readButtons() returns
+
+#endif
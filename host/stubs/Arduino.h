@@ -0,0 +1,84 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// just enough of the arduino core to build the sketch and the engine
+// on a host, time is simulated so runs are repeatable
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+// strings are never in flash on a host
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+class Print {
+    public:
+        virtual ~Print() {};
+        virtual size_t write(uint8_t) = 0;
+        virtual size_t write(const uint8_t*, size_t);
+        size_t write(const char*);
+
+        size_t print(const __FlashStringHelper*);
+        size_t print(const char*);
+        size_t print(char);
+        size_t print(unsigned char, int = 10);
+        size_t print(int, int = 10);
+        size_t print(unsigned int, int = 10);
+        size_t print(long, int = 10);
+        size_t print(unsigned long, int = 10);
+
+        size_t println();
+        size_t println(const __FlashStringHelper*);
+        size_t println(const char*);
+        size_t println(char);
+        size_t println(unsigned char, int = 10);
+        size_t println(int, int = 10);
+        size_t println(unsigned int, int = 10);
+        size_t println(long, int = 10);
+        size_t println(unsigned long, int = 10);
+};
+
+// what the sketch reads comes from host_serial_feed()
+// what it prints is collected for host_serial_take()
+#define HOST_SERIAL_RX 64
+
+class HardwareSerial : public Print {
+    public:
+        void begin(unsigned long);
+        void end();
+        int available();
+        int peek();
+        int read();
+        size_t readBytes(char*, size_t);
+        void flush();
+        size_t write(uint8_t);
+        using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+// simulated clock, only moves when something waits
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+
+// host side controls
+void host_clock_set_us(unsigned long long);
+unsigned long long host_clock_us();
+void host_clock_advance_us(unsigned long long);
+
+// called whenever the clock moves on (delay, sleep)
+// so a driver can deliver input that is due by then
+extern void (*host_clock_hook)();
+
+// false if the rx buffer is full, like a real uart it drops the rest
+bool host_serial_feed(const char*, size_t);
+size_t host_serial_rx_pending();
+size_t host_serial_take(char*, size_t);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <Arduino.h>
+
+#define HOST_EEPROM_SIZE 1024
+
+// a 1KB byte array erased to 0xFF like a new chip
+class EEPROMClass {
+    public:
+        EEPROMClass();
+        uint8_t read(int);
+        void write(int, uint8_t);
+        void update(int, uint8_t);
+        uint16_t length();
+
+        unsigned long cells_written; // for the harness
+        uint8_t cells[HOST_EEPROM_SIZE];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+// i2c is only used through the lcd stub
+#endif
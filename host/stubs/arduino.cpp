@@ -0,0 +1,337 @@
+// the stubbed arduino core, lcd, eeprom and sleep for host builds
+
+#include <Arduino.h>
+#include <Adafruit_RGBLCDShield.h>
+#include <EEPROM.h>
+#include <avr/sleep.h>
+
+
+// CLOCK
+
+static unsigned long long clock_us = 0;
+void (*host_clock_hook)() = NULL;
+
+void host_clock_set_us(unsigned long long us) {
+    clock_us = us;
+};
+
+unsigned long long host_clock_us() {
+    return clock_us;
+};
+
+void host_clock_advance_us(unsigned long long us) {
+    clock_us += us;
+    if (host_clock_hook) {
+        host_clock_hook();
+    };
+};
+
+// truncated to 32 bits so they wrap like the real ones
+unsigned long millis() {
+    return (uint32_t) (clock_us / 1000);
+};
+
+unsigned long micros() {
+    return (uint32_t) clock_us;
+};
+
+void delay(unsigned long ms) {
+    host_clock_advance_us(ms * 1000ull);
+};
+
+void delayMicroseconds(unsigned int us) {
+    host_clock_advance_us(us);
+};
+
+// PRINT
+
+size_t Print::write(const uint8_t* buf, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        n += this->write(buf[i]);
+    };
+    return n;
+};
+
+size_t Print::write(const char* str) {
+    return this->write((const uint8_t*) str, strlen(str));
+};
+
+static size_t print_number(Print* out, unsigned long n, int base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = buf + sizeof buf - 1;
+    *p = 0;
+    do {
+        unsigned long digit = n % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        n /= base;
+    } while (n);
+    return out->write(p);
+};
+
+size_t Print::print(const __FlashStringHelper* str) {
+    return this->write((const char*) str);
+};
+
+size_t Print::print(const char* str) {
+    return this->write(str);
+};
+
+size_t Print::print(char c) {
+    return this->write((uint8_t) c);
+};
+
+size_t Print::print(unsigned char n, int base) {
+    return print_number(this, n, base);
+};
+
+size_t Print::print(int n, int base) {
+    return this->print((long) n, base);
+};
+
+size_t Print::print(unsigned int n, int base) {
+    return print_number(this, n, base);
+};
+
+size_t Print::print(long n, int base) {
+    if (n < 0 && base == 10) {
+        return this->write('-') + print_number(this, -(unsigned long) n, base);
+    };
+    return print_number(this, n, base);
+};
+
+size_t Print::print(unsigned long n, int base) {
+    return print_number(this, n, base);
+};
+
+size_t Print::println() {
+    return this->write("\r\n");
+};
+
+size_t Print::println(const __FlashStringHelper* str) {
+    return this->print(str) + this->println();
+};
+
+size_t Print::println(const char* str) {
+    return this->print(str) + this->println();
+};
+
+size_t Print::println(char c) {
+    return this->print(c) + this->println();
+};
+
+size_t Print::println(unsigned char n, int base) {
+    return this->print(n, base) + this->println();
+};
+
+size_t Print::println(int n, int base) {
+    return this->print(n, base) + this->println();
+};
+
+size_t Print::println(unsigned int n, int base) {
+    return this->print(n, base) + this->println();
+};
+
+size_t Print::println(long n, int base) {
+    return this->print(n, base) + this->println();
+};
+
+size_t Print::println(unsigned long n, int base) {
+    return this->print(n, base) + this->println();
+};
+
+// SERIAL
+// rx is the size of the real uart buffer so overruns behave the same
+// tx is only drained by the host so it is larger
+
+#define HOST_SERIAL_TX 4096
+
+static char rx[HOST_SERIAL_RX];
+static size_t rx_head = 0;
+static size_t rx_len = 0;
+static char tx[HOST_SERIAL_TX];
+static size_t tx_len = 0;
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long) {};
+
+void HardwareSerial::end() {};
+
+int HardwareSerial::available() {
+    return rx_len;
+};
+
+int HardwareSerial::peek() {
+    return rx_len ? (unsigned char) rx[rx_head] : -1;
+};
+
+int HardwareSerial::read() {
+    if (!rx_len) {
+        return -1;
+    };
+    unsigned char c = rx[rx_head];
+    rx_head = (rx_head + 1) % HOST_SERIAL_RX;
+    rx_len--;
+    return c;
+};
+
+// like Stream::readBytes but without the timeout
+// the sketch only asks for what is available
+size_t HardwareSerial::readBytes(char* buf, size_t len) {
+    size_t n = 0;
+    while (n < len && rx_len) {
+        buf[n++] = this->read();
+    };
+    return n;
+};
+
+void HardwareSerial::flush() {};
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (tx_len == HOST_SERIAL_TX) {
+        return 0;
+    };
+    tx[tx_len++] = c;
+    return 1;
+};
+
+bool host_serial_feed(const char* buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (rx_len == HOST_SERIAL_RX) {
+            return false;
+        };
+        rx[(rx_head + rx_len) % HOST_SERIAL_RX] = buf[i];
+        rx_len++;
+    };
+    return true;
+};
+
+size_t host_serial_rx_pending() {
+    return rx_len;
+};
+
+size_t host_serial_take(char* buf, size_t len) {
+    size_t n = len < tx_len ? len : tx_len;
+    memcpy(buf, tx, n);
+    memmove(tx, tx + n, tx_len - n);
+    tx_len -= n;
+    return n;
+};
+
+// LCD
+// the shield drives the hd44780 in 4 bit mode through the port expander
+// so every command or character is 2 nibbles, each one i2c write
+// (setBacklight and readButtons are one transaction each)
+// each transaction is ~3 bytes at 100kHz so the clock is moved on by that
+// much, otherwise drawing would take no time at all in a replay
+
+#define LCD_I2C_PER_BYTE 2
+#define I2C_TRANSACTION_US 300
+
+static void i2c(unsigned long transactions) {
+    host_lcd.i2c_writes += transactions;
+    host_clock_advance_us(transactions * I2C_TRANSACTION_US);
+};
+
+HostLcdCounters host_lcd;
+char host_lcd_screen[2][17];
+uint8_t host_lcd_buttons = 0;
+
+static uint8_t lcd_col = 0;
+static uint8_t lcd_row = 0;
+
+Adafruit_RGBLCDShield::Adafruit_RGBLCDShield() {};
+
+void Adafruit_RGBLCDShield::begin(uint8_t, uint8_t) {
+    this->clear();
+};
+
+void Adafruit_RGBLCDShield::clear() {
+    memset(host_lcd_screen, ' ', sizeof host_lcd_screen);
+    host_lcd_screen[0][16] = 0;
+    host_lcd_screen[1][16] = 0;
+    lcd_col = 0;
+    lcd_row = 0;
+    i2c(LCD_I2C_PER_BYTE);
+};
+
+void Adafruit_RGBLCDShield::home() {
+    lcd_col = 0;
+    lcd_row = 0;
+    i2c(LCD_I2C_PER_BYTE);
+};
+
+void Adafruit_RGBLCDShield::setCursor(uint8_t col, uint8_t row) {
+    lcd_col = col;
+    lcd_row = row & 1;
+    i2c(LCD_I2C_PER_BYTE);
+};
+
+void Adafruit_RGBLCDShield::setBacklight(uint8_t) {
+    i2c(1);
+};
+
+void Adafruit_RGBLCDShield::createChar(uint8_t, uint8_t[]) {
+    i2c(LCD_I2C_PER_BYTE * 9);
+};
+
+uint8_t Adafruit_RGBLCDShield::readButtons() {
+    host_lcd.button_reads++;
+    i2c(1);
+    return host_lcd_buttons;
+};
+
+size_t Adafruit_RGBLCDShield::write(uint8_t c) {
+    if (lcd_col < 16) {
+        // custom chars 0-7 are shown as their code
+        host_lcd_screen[lcd_row][lcd_col] = c < 8 ? '0' + c : c;
+    };
+    lcd_col++;
+    host_lcd.chars++;
+    i2c(LCD_I2C_PER_BYTE);
+    return 1;
+};
+
+// EEPROM
+
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass() {
+    memset(this->cells, 0xFF, sizeof this->cells);
+    this->cells_written = 0;
+};
+
+uint8_t EEPROMClass::read(int address) {
+    return this->cells[address];
+};
+
+void EEPROMClass::write(int address, uint8_t value) {
+    this->cells[address] = value;
+    this->cells_written++;
+};
+
+void EEPROMClass::update(int address, uint8_t value) {
+    if (this->cells[address] != value) {
+        this->write(address, value);
+    };
+};
+
+uint16_t EEPROMClass::length() {
+    return HOST_EEPROM_SIZE;
+};
+
+// SLEEP
+// wake on the next timer0 overflow, every 1024us at 16MHz
+
+#define TIMER0_OVERFLOW_US 1024
+
+void set_sleep_mode(int) {};
+
+void sleep_enable() {};
+
+void sleep_cpu() {
+    host_clock_advance_us(TIMER0_OVERFLOW_US - clock_us % TIMER0_OVERFLOW_US);
+};
+
+void sleep_disable() {};
@@ -0,0 +1,13 @@
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+// idle sleep on the avr wakes on the next timer0 overflow (~1ms)
+// here sleep_cpu() just moves the simulated clock on by that much
+#define SLEEP_MODE_IDLE 0
+
+void set_sleep_mode(int);
+void sleep_enable();
+void sleep_cpu();
+void sleep_disable();
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef HOST_ADAFRUIT_MCP23017_H
+#define HOST_ADAFRUIT_MCP23017_H
+// the port expander is only used through the lcd stub
+#endif
@@ -0,0 +1,78 @@
+// host builds only, the sketch has no filesystem
+#ifndef ARDUINO
+
+#include "mapped_file_storage.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFileStorage::MappedFileStorage(const char* path, unsigned int size) {
+    this->base = NULL;
+    this->size = 0;
+
+    this->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (this->fd < 0) {
+        return;
+    };
+
+    // grow but never shrink, a smaller store would cut off saved devices
+    struct stat st;
+    if (fstat(this->fd, &st) != 0) {
+        return;
+    };
+    if ((unsigned long) st.st_size < size && ftruncate(this->fd, size) != 0) {
+        return;
+    };
+
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    if (mapping == MAP_FAILED) {
+        return;
+    };
+
+    this->base = (unsigned char*) mapping;
+    this->size = size;
+};
+
+MappedFileStorage::~MappedFileStorage() {
+    if (this->base) {
+        munmap(this->base, this->size);
+    };
+    if (this->fd >= 0) {
+        close(this->fd);
+    };
+};
+
+bool MappedFileStorage::is_open() {
+    return this->base != NULL;
+};
+
+unsigned int MappedFileStorage::length() {
+    return this->size;
+};
+
+unsigned char MappedFileStorage::read(unsigned int address) {
+    return this->base[address];
+};
+
+void MappedFileStorage::read_block(unsigned int address, void* buf, unsigned int len) {
+    memcpy(buf, this->base + address, len);
+};
+
+void MappedFileStorage::write_block(unsigned int address, const void* buf, unsigned int len) {
+    memcpy(this->base + address, buf, len);
+};
+
+void MappedFileStorage::commit() {
+    if (this->base) {
+        msync(this->base, this->size, MS_SYNC);
+    };
+};
+
+const unsigned char* MappedFileStorage::view() {
+    return this->base;
+};
+
+#endif
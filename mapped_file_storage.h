@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_STORAGE_H
+#define MAPPED_FILE_STORAGE_H
+
+// host builds only, the sketch has no filesystem
+#ifndef ARDUINO
+
+#include "storage.h"
+
+// a file mapped into memory, for host builds with more
+// capacity than the eeprom, loads scan the mapping directly
+// (a device is still copied once, into the table) and commit() msyncs it back to disk
+class MappedFileStorage : public Storage {
+    private:
+        int fd;
+        unsigned char* base;
+        unsigned int size;
+
+        // owns the fd and the mapping, a copy would unmap it twice
+        MappedFileStorage(const MappedFileStorage&) = delete;
+        MappedFileStorage& operator=(const MappedFileStorage&) = delete;
+
+    public:
+        // creates (or grows) the file to size bytes
+        // check is_open() as a failed open just gives an empty store
+        MappedFileStorage(const char*, unsigned int);
+        ~MappedFileStorage();
+        bool is_open();
+
+        unsigned int length();
+        unsigned char read(unsigned int);
+        void read_block(unsigned int, void*, unsigned int);
+        void write_block(unsigned int, const void*, unsigned int);
+        void commit();
+        const unsigned char* view();
+};
+
+#endif
+#endif
@@ -0,0 +1,81 @@
+#include "marquee.h"
+#include "util.h"
+
+#include <Adafruit_RGBLCDShield.h>
+#include <Arduino.h>
+
+Marquee::Marquee(unsigned NUMBER col, unsigned NUMBER row, unsigned NUMBER width) {
+    this->col = col;
+    this->row = row;
+    this->width = width;
+    this->step_ms = MARQUEE_STEP_MS;
+    this->pause_ms = MARQUEE_PAUSE_MS;
+    this->stop();
+};
+
+void Marquee::start(const char* text, unsigned long now) {
+    this->text = text;
+    this->len = strlen(text);
+    this->offset = 0;
+    this->next_tick = now + this->step_ms;
+
+    // no need to scroll if it fits
+    if (this->len <= (NUMBER) this->width) {
+        this->last_offset = 0;
+        return;
+    };
+    this->last_offset = this->len - this->width + MARQUEE_TRAILING_BLANKS;
+};
+
+void Marquee::stop() {
+    this->text = "";
+    this->len = 0;
+    this->offset = 0;
+    this->last_offset = 0;
+};
+
+bool Marquee::is_scrolling() {
+    return this->last_offset != 0;
+};
+
+// only meaningful while is_scrolling()
+unsigned long Marquee::next_deadline() {
+    return this->next_tick;
+};
+
+unsigned NUMBER Marquee::tick(Adafruit_RGBLCDShield* lcd, unsigned long now) {
+    if (!this->is_scrolling()) {
+        return 0;
+    };
+
+    // signed difference so this survives millis() wrapping
+    if ((long) (now - this->next_tick) < 0) {
+        return 0;
+    };
+
+    NUMBER prev_offset = this->offset;
+    unsigned NUMBER cells = this->width;
+
+    if (this->offset >= this->last_offset) {
+        // back to the start and wait there
+        this->offset = 0;
+        this->next_tick = now + this->pause_ms;
+    } else {
+        this->offset++;
+        this->next_tick = now + this->step_ms;
+
+        // once the text has scrolled past the left of the window
+        // the cells on the right were blank and stay blank, so skip them
+        NUMBER changed = this->len - prev_offset;
+        if (changed >= 0 && changed < (NUMBER) cells) {
+            cells = changed;
+        };
+    };
+
+    lcd->setCursor(this->col, this->row);
+    for (unsigned NUMBER i = 0; i < cells; i++) {
+        NUMBER c = this->offset + i;
+        lcd->write((uint8_t) (c < this->len ? this->text[c] : 0));
+    };
+    return cells;
+};
@@ -0,0 +1,44 @@
+#ifndef MARQUEE_H
+#define MARQUEE_H
+
+#include "util.h"
+#include <Adafruit_RGBLCDShield.h>
+#include <Arduino.h>
+
+#define MARQUEE_STEP_MS 500 // 2 chars a second
+#define MARQUEE_PAUSE_MS 2000 // wait at the start before scrolling again
+#define MARQUEE_TRAILING_BLANKS 4 // blanks shown after the text to show the end
+
+// scrolls text that doesnt fit through a fixed window of lcd cells
+// each field that can overflow gets its own marquee
+class Marquee {
+    private:
+        const char* text;
+        NUMBER len;
+        NUMBER last_offset; // precomputed so tick doesnt need strlen
+        NUMBER offset;
+        unsigned long next_tick;
+
+        // window
+        unsigned NUMBER col;
+        unsigned NUMBER row;
+        unsigned NUMBER width;
+
+    public:
+        Marquee(unsigned NUMBER col, unsigned NUMBER row, unsigned NUMBER width);
+
+        unsigned int step_ms;
+        unsigned int pause_ms;
+
+        // the text must outlive the marquee or be replaced with start/stop
+        // assumes offset 0 is already on screen
+        void start(const char*, unsigned long);
+        void stop();
+        bool is_scrolling();
+        unsigned long next_deadline();
+
+        // returns the number of cells written, 0 if nothing changed
+        unsigned NUMBER tick(Adafruit_RGBLCDShield*, unsigned long);
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef PGM_H
+#define PGM_H
+
+// strings and tables in flash on the avr
+// and plain memory anywhere else (host builds)
+#ifdef ARDUINO
+#include <avr/pgmspace.h>
+#else
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char*
+#define pgm_read_byte(address) (*(const uint8_t*) (address))
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+#include "scheduler.h"
+#include "errors.h"
+
+#include <Arduino.h>
+
+Scheduler::Scheduler() {
+    for (signed char i = 0; i < WHEEL_SLOTS; i++) {
+        this->wheel[i] = NO_ENTRY;
+    };
+
+    // thread every action onto the free list
+    for (signed char i = 0; i < SCHEDULE_CAPACITY; i++) {
+        this->actions[i].next = i + 1;
+    };
+    this->actions[SCHEDULE_CAPACITY - 1].next = NO_ENTRY;
+    this->free_head = 0;
+
+    this->started = false;
+    this->cursor_end = 0;
+};
+
+void Scheduler::link(signed char i) {
+    signed char slot = (this->actions[i].due >> WHEEL_SLOT_SHIFT) & (WHEEL_SLOTS - 1);
+    this->actions[i].next = this->wheel[slot];
+    this->wheel[slot] = i;
+};
+
+HRESULT Scheduler::add(const char id[4], ScheduledActionType type, char value, unsigned long due, unsigned long period) {
+    if (this->free_head == NO_ENTRY) {
+        return E_STATE_SCHEDULE_FULL;
+    };
+
+    signed char i = this->free_head;
+    this->free_head = this->actions[i].next;
+
+    memcpy(this->actions[i].id, id, 4);
+    this->actions[i].type = type;
+    this->actions[i].value = value;
+    this->actions[i].due = due;
+    this->actions[i].period = period;
+
+    this->link(i);
+    return S_OK;
+};
+
+// returns how many actions were cancelled
+signed char Scheduler::cancel(const char id[4]) {
+    signed char cancelled = 0;
+
+    for (signed char slot = 0; slot < WHEEL_SLOTS; slot++) {
+        signed char* prev = &this->wheel[slot];
+
+        while (*prev != NO_ENTRY) {
+            signed char i = *prev;
+            if (strcmp(this->actions[i].id, id) != 0) {
+                prev = &this->actions[i].next;
+                continue;
+            };
+
+            // unlink and free
+            *prev = this->actions[i].next;
+            this->actions[i].next = this->free_head;
+            this->free_head = i;
+            cancelled++;
+        };
+    };
+    return cancelled;
+};
+
+bool Scheduler::pop_due(unsigned long now, ScheduledAction* action) {
+    unsigned long latest_end = (now >> WHEEL_SLOT_SHIFT) << WHEEL_SLOT_SHIFT;
+
+    // the first call (or a long stall) can leave us more than a rotation behind
+    // every slot gets visited in one rotation anyway so skip straight there
+    unsigned long span = (WHEEL_SLOTS - 1) * WHEEL_SLOT_MS;
+    if (!this->started || (long) (latest_end - this->cursor_end) > (long) span) {
+        this->cursor_end = latest_end - span;
+        this->started = true;
+    };
+
+    // signed difference so this survives millis() wrapping
+    while ((long) (now - this->cursor_end) >= 0) {
+        signed char slot = ((this->cursor_end >> WHEEL_SLOT_SHIFT) - 1) & (WHEEL_SLOTS - 1);
+        signed char* prev = &this->wheel[slot];
+
+        // actions due on a later rotation stay where they are
+        while (*prev != NO_ENTRY) {
+            signed char i = *prev;
+            if ((long) (now - this->actions[i].due) < 0) {
+                prev = &this->actions[i].next;
+                continue;
+            };
+
+            *prev = this->actions[i].next;
+            *action = this->actions[i];
+            this->actions[i].next = this->free_head;
+            this->free_head = i;
+            return true;
+        };
+
+        this->cursor_end += WHEEL_SLOT_MS;
+    };
+
+    return false;
+};
+
+bool Scheduler::next_deadline(unsigned long* deadline) {
+    for (signed char slot = 0; slot < WHEEL_SLOTS; slot++) {
+        if (this->wheel[slot] != NO_ENTRY) {
+            *deadline = this->cursor_end;
+            return true;
+        };
+    };
+    return false;
+};
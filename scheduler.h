@@ -0,0 +1,73 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "errors.h"
+#include <Arduino.h>
+
+// pending actions across every device, 15 bytes each on the avr
+// 8 is 120 bytes of the 2KB of sram, host builds (the gateway) pass
+// a bigger one with -DSCHEDULE_CAPACITY
+// entries are linked by signed char index so 127 is the ceiling
+#ifndef SCHEDULE_CAPACITY
+#define SCHEDULE_CAPACITY 8
+#endif
+#if SCHEDULE_CAPACITY < 1 || SCHEDULE_CAPACITY > 127
+#error "SCHEDULE_CAPACITY must be 1 to 127"
+#endif
+#define NO_ENTRY -1
+
+// hashed timer wheel
+// each slot is 2^WHEEL_SLOT_SHIFT ms (~1s) and holds every action that is due
+// in that slot on any rotation, a power of 2 so slots line up when millis() wraps
+#define WHEEL_SLOTS 8 // must be a power of 2
+#define WHEEL_SLOT_SHIFT 10
+#define WHEEL_SLOT_MS (1ul << WHEEL_SLOT_SHIFT)
+
+// keep deadlines within half of millis() so signed comparisons hold
+#define SCHEDULE_MAX_SECONDS 2000000ul
+
+
+enum ScheduledActionType: char {
+    SetState,
+    SetPower,
+};
+
+struct ScheduledAction {
+    char id[4];
+    ScheduledActionType type;
+    char value; // bool for SetState
+    signed char next; // next action in the same slot (or free list)
+    unsigned long due;
+    unsigned long period; // ms, 0 if it only happens once
+};
+
+// fixed capacity so we never touch the heap
+// checking for due actions is one comparison per loop()
+// until a slot has fully elapsed, no matter how many are pending
+// once it has, pop_due walks that slot's chain, which holds every action
+// hashed to it on any rotation (about SCHEDULE_CAPACITY / WHEEL_SLOTS)
+// so the cost of a slot visit grows with the entries in it, not O(1)
+class Scheduler {
+    private:
+        ScheduledAction actions[SCHEDULE_CAPACITY];
+        signed char wheel[WHEEL_SLOTS];
+        signed char free_head;
+        bool started;
+        unsigned long cursor_end; // end of the oldest slot not yet drained
+
+        void link(signed char);
+
+    public:
+        Scheduler();
+        HRESULT add(const char[4], ScheduledActionType, char, unsigned long, unsigned long);
+        signed char cancel(const char[4]);
+
+        // pops one due action into the buffer, call until it returns false
+        bool pop_due(unsigned long, ScheduledAction*);
+
+        // when pop_due next needs to look at the wheel
+        // false if nothing is pending
+        bool next_deadline(unsigned long*);
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "sram.h"
+
+#include <Arduino.h>
+
+#ifdef ARDUINO
+
+extern char *__brkval;
+extern char __heap_start;
+extern char __data_start;
+extern char __bss_end;
+
+// the code on learn didnt work for me (idk why)
+// __brkval is 0 until the first malloc so fall back to where the heap would start
+// (no malloc here, that would leave a chunk header in the painted gap)
+uintptr_t calculate_free_memory() {
+    // ref to stack var can be treated
+    // as the top of stack pointer
+    char sp;
+    char* heap_end = __brkval ? __brkval : &__heap_start;
+
+    // BOUNDRY BETWEEN STACK AND HEAP
+    return &sp - heap_end;
+};
+
+// must be called first thing in setup() so nothing
+// below us on the stack gets painted over
+void paint_stack() {
+    char sp;
+    char* p = __brkval ? __brkval : &__heap_start;
+
+    while (p < &sp - STACK_PAINT_MARGIN) {
+        *p++ = STACK_CANARY;
+    };
+};
+
+// the smallest the gap between the heap and the stack has ever been
+// scans up from the end of the heap until the stack has written over the paint
+// anything the heap left at its end (chunk headers etc) is skipped first
+// otherwise the scan stops straight away and always reports 0
+// this is O(free memory) so dont call it every loop
+uintptr_t calculate_min_free_memory() {
+    char sp;
+    char* p = __brkval ? __brkval : &__heap_start;
+    uintptr_t untouched = 0;
+
+    while (p < &sp && *(unsigned char*)p != STACK_CANARY) {
+        p++;
+    };
+    while (p < &sp && *(unsigned char*)p == STACK_CANARY) {
+        p++;
+        untouched++;
+    };
+    return untouched;
+};
+
+unsigned int calculate_static_memory() {
+    return &__bss_end - &__data_start;
+};
+
+#else
+
+uintptr_t calculate_free_memory() {
+    return 0;
+};
+
+void paint_stack() {};
+
+uintptr_t calculate_min_free_memory() {
+    return 0;
+};
+
+unsigned int calculate_static_memory() {
+    return 0;
+};
+
+#endif
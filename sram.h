@@ -0,0 +1,23 @@
+#ifndef SRAM_H
+#define SRAM_H
+
+#include <Arduino.h>
+
+// avr memory inspection
+// kept out of util so the engine builds anywhere
+// on a host there is no heap/stack gap to look at so these are all 0
+
+uintptr_t calculate_free_memory();
+
+// stack painting
+// the gap between the heap and the stack is filled with STACK_CANARY at boot
+// so we can later see how far the stack has ever reached into it
+#define STACK_CANARY 0xA5
+#define STACK_PAINT_MARGIN 32 // dont paint over our own frame
+void paint_stack();
+uintptr_t calculate_min_free_memory();
+
+// everything the linker placed in .data and .bss
+unsigned int calculate_static_memory();
+
+#endif
@@ -0,0 +1,55 @@
+#!/bin/sh
+# static sram (.data + .bss) used by each module of the sketch
+# .data also costs flash as it is copied into ram at boot
+#
+# usage: ./sram_report.sh [build path] [before build path]
+# build with: arduino-cli compile -b arduino:avr:uno --build-path build .
+#
+# given a second build (e.g. of the previous commit) the sram of each
+# module is printed for both with the difference, so a change can quote
+# before/after numbers
+
+BUILD=${1:-build}
+BEFORE=$2
+
+for dir in "$BUILD" $BEFORE; do
+    if [ ! -d "$dir/sketch" ]; then
+        echo "no compiled sketch in $dir, build with --build-path $dir first" >&2
+        exit 1
+    fi
+done
+
+# NAME DATA BSS for every object and the linked elf (as TOTAL)
+sizes() {
+    for obj in "$1"/sketch/*.o; do
+        avr-size "$obj" | awk -v name="$(basename "$obj" .o)" \
+            'NR == 2 { print name, $2, $3 }'
+    done
+    # everything linked in, including the arduino core and libraries
+    for elf in "$1"/*.elf; do
+        avr-size "$elf" | awk 'NR == 2 { print "TOTAL", $2, $3 }'
+    done
+}
+
+if [ -z "$BEFORE" ]; then
+    printf '%-28s %6s %6s %6s\n' MODULE DATA BSS SRAM
+    sizes "$BUILD" | awk '{ printf "%-28s %6d %6d %6d\n", $1, $2, $3, $2 + $3 }'
+    exit 0
+fi
+
+# modules only in one build count as 0 in the other
+printf '%-28s %6s %6s %6s\n' MODULE BEFORE AFTER DELTA
+{
+    sizes "$BEFORE" | awk '{ print "B", $1, $2 + $3 }'
+    sizes "$BUILD" | awk '{ print "A", $1, $2 + $3 }'
+} | awk '
+    $1 == "B" { before[$2] = $3; seen[$2] = 1 }
+    $1 == "A" { after[$2] = $3; seen[$2] = 1 }
+    END {
+        for (name in seen) {
+            if (name != "TOTAL") {
+                printf "%-28s %6d %6d %+6d\n", name, before[name], after[name], after[name] - before[name]
+            }
+        }
+        printf "%-28s %6d %6d %+6d\n", "TOTAL", before["TOTAL"], after["TOTAL"], after["TOTAL"] - before["TOTAL"]
+    }'
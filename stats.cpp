@@ -0,0 +1,302 @@
+#include "stats.h"
+#include "errors.h"
+#include "sram.h"
+
+#include <Arduino.h>
+
+// file scoped so it costs nothing for callers to record into
+// (no pointers to pass around the loop)
+static PhaseStats phases[NUM_PHASES];
+static uint16_t commands_processed;
+static uint8_t errors[STATS_ERROR_SLOTS];
+static unsigned int static_ram[NUM_RAM_REGIONS];
+static unsigned long frames_drawn;
+static unsigned long lcd_chars_written;
+static unsigned long eeprom_bytes_written;
+static unsigned long loops;
+static unsigned long sleeps;
+static unsigned long slept_ms;
+static unsigned long loops_avoided;
+static unsigned long wakes[NUM_WAKE_CAUSES];
+
+static bool tracing = false;
+
+static bool stats_initialised = false;
+
+
+static void add_saturating(unsigned long* counter, unsigned long n) {
+    if (*counter > STATS_SATURATED - n) {
+        *counter = STATS_SATURATED;
+    } else {
+        *counter += n;
+    };
+};
+
+static void count_saturating(uint16_t* counter) {
+    if (*counter < STATS_COUNT_SATURATED) {
+        (*counter)++;
+    };
+};
+
+unsigned long stats_begin() {
+    return micros();
+};
+
+void stats_end(StatPhase phase, unsigned long start) {
+    if (!stats_initialised) {
+        reset_stats();
+    };
+
+    // unsigned subtraction handles micros() wrapping every ~70 minutes
+    unsigned long elapsed = micros() - start;
+    PhaseStats* p = &phases[phase];
+
+    if (elapsed < p->min) {
+        p->min = elapsed;
+    };
+    if (elapsed > p->max) {
+        p->max = elapsed;
+    };
+    if (p->count < STATS_COUNT_SATURATED && p->total <= STATS_SATURATED - elapsed) {
+        p->total += elapsed;
+        p->count++;
+    };
+
+    // shift instead of dividing to find the bucket
+    // as division is very slow on the avr
+    unsigned long bound = elapsed >> STATS_FIRST_BUCKET_SHIFT;
+    unsigned char bucket = 0;
+    while (bound && bucket < STATS_BUCKETS - 1) {
+        bound >>= 2;
+        bucket++;
+    };
+    count_saturating(&p->buckets[bucket]);
+};
+
+void stats_record_command() {
+    count_saturating(&commands_processed);
+};
+
+void stats_record_error(HRESULT hresult) {
+    unsigned char slot;
+    if (hresult & E_COMMAND_GENERAL_INVALID) {
+        slot = hresult - E_COMMAND_GENERAL_INVALID;
+    } else if (hresult & E_STATE_GENERAL_ERROR) {
+        slot = (STATS_ERROR_SLOTS / 2) + (hresult - E_STATE_GENERAL_ERROR);
+    } else {
+        return; // not an error
+    };
+
+    // anything that doesnt fit is lumped into the last slot
+    if (slot >= STATS_ERROR_SLOTS) {
+        slot = STATS_ERROR_SLOTS - 1;
+    };
+    if (errors[slot] < STATS_ERROR_SATURATED) {
+        errors[slot]++;
+    };
+};
+
+void stats_record_frame() {
+    add_saturating(&frames_drawn, 1);
+};
+
+void stats_record_lcd_chars(unsigned int chars) {
+    add_saturating(&lcd_chars_written, chars);
+};
+
+// only bytes the eeprom backend actually changed
+// so this is the cell wear, not how much was saved
+void stats_record_eeprom_bytes(unsigned int bytes) {
+    add_saturating(&eeprom_bytes_written, bytes);
+};
+
+void stats_record_loop() {
+    add_saturating(&loops, 1);
+};
+
+// a loop that didnt sleep would have gone round once per pass
+// so the time slept divided by how long the pass before it took
+// is the number of loop() iterations we didnt spin
+void stats_record_sleep(WakeCause cause, unsigned long slept_us, unsigned long loop_us) {
+    add_saturating(&sleeps, 1);
+    add_saturating(&wakes[cause], 1);
+    add_saturating(&slept_ms, (slept_us + 500) / 1000);
+    add_saturating(&loops_avoided, slept_us / (loop_us ? loop_us : 1));
+};
+
+bool stats_toggle_trace() {
+    tracing = !tracing;
+    return tracing;
+};
+
+bool stats_tracing() {
+    return tracing;
+};
+
+void stats_record_static_ram(RamRegion region, unsigned int bytes) {
+    static_ram[region] = bytes;
+};
+
+void reset_stats() {
+    memset(phases, 0, sizeof phases);
+    memset(errors, 0, sizeof errors);
+    memset(wakes, 0, sizeof wakes);
+    for (unsigned char i = 0; i < NUM_PHASES; i++) {
+        phases[i].min = 0xFFFFFFFFul;
+    };
+    commands_processed = 0;
+    frames_drawn = 0;
+    lcd_chars_written = 0;
+    eeprom_bytes_written = 0;
+    loops = 0;
+    sleeps = 0;
+    slept_ms = 0;
+    loops_avoided = 0;
+    stats_initialised = true;
+};
+
+static void print_ram_region_name(unsigned char region) {
+    switch (region) {
+        case RAM_DEVICES:
+            Serial.print(F(" devices="));
+            break;
+        case RAM_BUFFERS:
+            Serial.print(F(" buffers="));
+            break;
+        case RAM_LCD:
+            Serial.print(F(" lcd="));
+            break;
+        case RAM_SERIAL:
+            Serial.print(F(" serial="));
+            break;
+    };
+};
+
+// SRAM free=NOW low=WORST
+// STATIC devices=B buffers=B lcd=B serial=B stats=B other=B total=B
+static void print_memory() {
+    Serial.print(F("SRAM free="));
+    Serial.print(calculate_free_memory());
+    Serial.print(F(" low="));
+    Serial.println(calculate_min_free_memory());
+
+    unsigned int total = calculate_static_memory();
+    unsigned int own = sizeof phases + sizeof errors + sizeof static_ram + sizeof commands_processed
+        + sizeof frames_drawn + sizeof lcd_chars_written + sizeof eeprom_bytes_written + sizeof tracing
+        + sizeof loops + sizeof sleeps + sizeof slept_ms + sizeof loops_avoided + sizeof wakes;
+    unsigned int accounted = own;
+
+    Serial.print(F("STATIC"));
+    for (unsigned char i = 0; i < NUM_RAM_REGIONS; i++) {
+        print_ram_region_name(i);
+        Serial.print(static_ram[i]);
+        accounted += static_ram[i];
+    };
+    Serial.print(F(" stats="));
+    Serial.print(own);
+    Serial.print(F(" other="));
+    // total is 0 on a host build
+    Serial.print(total > accounted ? total - accounted : 0);
+    Serial.print(F(" total="));
+    Serial.println(total);
+};
+
+static void print_phase_name(unsigned char phase) {
+    switch (phase) {
+        case PHASE_SERIAL_PARSE:
+            Serial.print(F("PARSE"));
+            break;
+        case PHASE_EXECUTE:
+            Serial.print(F("EXEC"));
+            break;
+        case PHASE_READ_BUTTONS:
+            Serial.print(F("BUTTONS"));
+            break;
+        case PHASE_DISPLAY:
+            Serial.print(F("DISPLAY"));
+            break;
+        case PHASE_EEPROM:
+            Serial.print(F("EEPROM"));
+            break;
+    };
+};
+
+// one line per phase so the host can grep for the one it cares about
+// PHASE n=COUNT min=US max=US avg=US h=B0,B1,...
+void print_stats() {
+    if (!stats_initialised) {
+        reset_stats();
+    };
+
+    Serial.println();
+    for (unsigned char i = 0; i < NUM_PHASES; i++) {
+        PhaseStats* p = &phases[i];
+        print_phase_name(i);
+        Serial.print(F(" n="));
+        Serial.print(p->count);
+        Serial.print(F(" min="));
+        Serial.print(p->count ? p->min : 0);
+        Serial.print(F(" max="));
+        Serial.print(p->max);
+        Serial.print(F(" avg="));
+        Serial.print(p->count ? p->total / p->count : 0);
+        Serial.print(F(" h="));
+        for (unsigned char b = 0; b < STATS_BUCKETS; b++) {
+            if (b) {
+                Serial.print(',');
+            };
+            Serial.print(p->buckets[b]);
+        };
+        Serial.println();
+    };
+
+    Serial.print(F("CMDS "));
+    Serial.println(commands_processed);
+
+    // LCD frames=N chars=N per_frame=N
+    // each char is a few i2c transactions to the port expander
+    Serial.print(F("LCD frames="));
+    Serial.print(frames_drawn);
+    Serial.print(F(" chars="));
+    Serial.print(lcd_chars_written);
+    Serial.print(F(" per_frame="));
+    Serial.println(frames_drawn ? lcd_chars_written / frames_drawn : 0);
+
+    Serial.print(F("EEPROM written="));
+    Serial.println(eeprom_bytes_written);
+
+    // IDLE loops=N sleeps=N slept_ms=N avoided=N
+    // WAKE serial=N deadline=N poll=N
+    Serial.print(F("IDLE loops="));
+    Serial.print(loops);
+    Serial.print(F(" sleeps="));
+    Serial.print(sleeps);
+    Serial.print(F(" slept_ms="));
+    Serial.print(slept_ms);
+    Serial.print(F(" avoided="));
+    Serial.println(loops_avoided);
+
+    Serial.print(F("WAKE serial="));
+    Serial.print(wakes[WAKE_SERIAL]);
+    Serial.print(F(" deadline="));
+    Serial.print(wakes[WAKE_DEADLINE]);
+    Serial.print(F(" poll="));
+    Serial.println(wakes[WAKE_POLL]);
+
+    // only print errors that have happened
+    // ERR HRESULT:COUNT
+    for (unsigned char i = 0; i < STATS_ERROR_SLOTS; i++) {
+        if (!errors[i]) {
+            continue;
+        };
+        unsigned char hresult = (i < STATS_ERROR_SLOTS / 2)
+            ? E_COMMAND_GENERAL_INVALID + i
+            : E_STATE_GENERAL_ERROR + (i - STATS_ERROR_SLOTS / 2);
+        Serial.print(F("ERR "));
+        Serial.print(hresult);
+        Serial.print(':');
+        Serial.println(errors[i]);
+    };
+
+    print_memory();
+};
@@ -0,0 +1,95 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "errors.h"
+#include <Arduino.h>
+
+// histogram buckets are powers of 4 in micros
+// [<64, <256, <1024, <4096, <16384, rest]
+#define STATS_BUCKETS 6
+#define STATS_FIRST_BUCKET_SHIFT 6
+
+// 8 command errors + 7 state errors
+// with room to spare so new errors dont overflow
+#define STATS_ERROR_SLOTS 16
+
+
+enum StatPhase: char {
+    PHASE_SERIAL_PARSE,
+    PHASE_EXECUTE,
+    PHASE_READ_BUTTONS,
+    PHASE_DISPLAY,
+    PHASE_EEPROM,
+    NUM_PHASES
+};
+
+// static sram owners, sizes are handed in from setup()
+// as this module cant see the other globals
+enum RamRegion: char {
+    RAM_DEVICES,
+    RAM_BUFFERS,
+    RAM_LCD,
+    RAM_SERIAL,
+    NUM_RAM_REGIONS
+};
+
+// every counter sticks at its maximum instead of wrapping
+// total and count stop together so total / count stays a true mean
+// counts are 16 bit to keep the phase table small (26 bytes a phase)
+// a busy phase saturates them in a few minutes, RESET starts them again
+#define STATS_SATURATED 0xFFFFFFFFul
+#define STATS_COUNT_SATURATED 0xFFFF
+#define STATS_ERROR_SATURATED 0xFF
+
+struct PhaseStats {
+    unsigned long min;
+    unsigned long max;
+    unsigned long total;
+    uint16_t count;
+    uint16_t buckets[STATS_BUCKETS];
+};
+
+// usage:
+// unsigned long start = stats_begin();
+// ... phase ...
+// stats_end(PHASE_X, start);
+unsigned long stats_begin();
+void stats_end(StatPhase, unsigned long);
+
+void stats_record_command();
+void stats_record_error(HRESULT);
+
+void stats_record_static_ram(RamRegion, unsigned int);
+
+// throughput counters for the display and eeprom paths
+void stats_record_frame();
+void stats_record_lcd_chars(unsigned int);
+void stats_record_eeprom_bytes(unsigned int);
+
+// idle sleep
+// timer0 wakes the cpu every ~1ms in idle mode so counting raw wakeups
+// just measures time asleep, instead record why each sleep ended
+// and how many loop() passes it saved
+enum WakeCause: char {
+    WAKE_SERIAL,   // a command started arriving
+    WAKE_DEADLINE, // marquee step, scheduled action or button lockout
+    WAKE_POLL,     // nothing due, woke to poll the buttons
+    NUM_WAKE_CAUSES
+};
+
+void stats_record_loop();
+// usage:
+// stats_record_sleep(cause, micros slept, micros the loop pass before the sleep took)
+void stats_record_sleep(WakeCause, unsigned long, unsigned long);
+
+// trace mode echoes every command and button change
+// with a millis() timestamp so the host can record a session
+// T <ms> C <command>
+// T <ms> B <button bitmask>
+bool stats_toggle_trace();
+bool stats_tracing();
+
+void print_stats();
+void reset_stats();
+
+#endif
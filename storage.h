@@ -0,0 +1,27 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+
+// somewhere SmartHomeState can persist its devices
+// byte addressed like the eeprom, offsets start at 0
+class Storage {
+    public:
+        virtual ~Storage() {};
+
+        virtual unsigned int length() = 0;
+        virtual unsigned char read(unsigned int) = 0;
+        virtual void read_block(unsigned int, void*, unsigned int) = 0;
+        virtual void write_block(unsigned int, const void*, unsigned int) = 0;
+
+        // make writes durable, for backends that buffer them
+        virtual void commit() {};
+
+        // the whole store if it is directly addressable (memory mapped)
+        // so loads can scan it without a read() call per byte, NULL otherwise
+        virtual const unsigned char* view() {
+            return NULL;
+        };
+};
+
+#endif
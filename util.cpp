@@ -1,18 +1,59 @@
 #include "device.h"
 #include "util.h"
 #include "errors.h"
+#include "pgm.h"
 
 #include <Adafruit_RGBLCDShield.h>
 #include <Arduino.h>
-#include <EEPROM.h>
 
 
-extern char *__brkval;
+// indexed the same as buttons_down_since
+// in flash rather than rebuilt on the stack every call
+const uint8_t BUTTONS[NUM_BUTTONS] PROGMEM = {
+    BUTTON_UP,
+    BUTTON_DOWN,
+    BUTTON_LEFT,
+    BUTTON_RIGHT,
+    BUTTON_SELECT,
+};
 
 SmartHomeState::SmartHomeState() {
     this->num_devices = 0;
     memset(this->devices_slots_free, true, MAX_CAPACITY);
     this-> current_device_index = 0;
+    this->storage = NULL;
+    this->output = NULL;
+    this->epoch = 0;
+    this->version = 0;
+    memset(this->device_versions, 0, sizeof this->device_versions);
+    memset(this->deletions, 0, sizeof this->deletions);
+    this->next_deletion = 0;
+    this->forgotten_before = 0;
+};
+
+// bumps the boot counter kept at the end of storage
+// one 2 byte write per boot so it is no real wear on the eeprom
+void SmartHomeState::use_storage(Storage* storage) {
+    this->storage = storage;
+
+    unsigned int length = storage->length();
+    if (length < BOOT_EPOCH_BYTES) {
+        return;
+    };
+
+    Version epoch;
+    storage->read_block(length - BOOT_EPOCH_BYTES, &epoch, BOOT_EPOCH_BYTES);
+    // 0 is kept for no storage
+    if (++epoch == 0) {
+        ++epoch;
+    };
+    storage->write_block(length - BOOT_EPOCH_BYTES, &epoch, BOOT_EPOCH_BYTES);
+    storage->commit();
+    this->epoch = epoch;
+};
+
+void SmartHomeState::use_output(Print* output) {
+    this->output = output;
 };
 
 NUMBER SmartHomeState::next_free_index() {
@@ -24,7 +65,7 @@ NUMBER SmartHomeState::next_free_index() {
     return -1;
 };
 
-NUMBER SmartHomeState::get_device_index_by_id(char id[4]) {
+NUMBER SmartHomeState::get_device_index_by_id(const char id[4]) {
     for (NUMBER i = 0; i < MAX_CAPACITY; i++) {
         if (!this->devices_slots_free[i] && strcmp(this->devices[i].id, id) == 0) {
             return i;
@@ -33,9 +74,9 @@ NUMBER SmartHomeState::get_device_index_by_id(char id[4]) {
     return -1; // not found
 };
 
-HRESULT SmartHomeState::add_device(Device device) {
+HRESULT SmartHomeState::add_device(const Device* device) {
 
-    if (this->get_device_index_by_id(device.id) != -1) {
+    if (this->get_device_index_by_id(device->id) != -1) {
         return E_STATE_CONFLICTING_DEVICE;
     };
 
@@ -44,7 +85,7 @@ HRESULT SmartHomeState::add_device(Device device) {
     };
 
 
-    NUMBER i = this->insert(device.id); 
+    NUMBER i = this->insert(device->id); 
 
 
     if (!this->devices_slots_free[i]) {
@@ -58,20 +99,22 @@ HRESULT SmartHomeState::add_device(Device device) {
         }
     }
 
-    this->devices[i] = device;
+    this->devices[i] = *device;
     this->devices_slots_free[i] = false;
+    this->touch(i);
     this->is_current = false;
     this-> num_devices += 1;
     return S_OK;
 };
 
-NUMBER SmartHomeState::insert(char id[4]){
+NUMBER SmartHomeState::insert(const char id[4]){
 
     if (this->num_devices == 0) {
         return 0;
     };
 
-    NUMBER last_taken_spot;
+    // num_devices isnt 0 so the loop always sets this
+    NUMBER last_taken_spot = 0;
 
     for (NUMBER i = 0; i < MAX_CAPACITY; i ++) {
         if (this->devices_slots_free[i]) {
@@ -115,6 +158,7 @@ bool SmartHomeState::shuffle_up(NUMBER after) {
     // up into the free place
     for (NUMBER i = free_index; i > after; i--) {
         this->devices[i] = this->devices[i-1]; 
+        this->device_versions[i] = this->device_versions[i-1];
         this->devices_slots_free[i] = false;
         this->devices_slots_free[i-1] = true;
     };
@@ -144,6 +188,7 @@ bool SmartHomeState::shuffle_down(NUMBER before) {
 
     for (NUMBER i = free_index; i < before; i++) {
         this->devices[i] = this->devices[i+1]; 
+        this->device_versions[i] = this->device_versions[i+1];
         this->devices_slots_free[i] = false;
         this->devices_slots_free[i+1] = true;
     };
@@ -156,6 +201,16 @@ HRESULT SmartHomeState::remove_device(char id[4]) {
     if (i != -1) {
         this->devices_slots_free[i] = true;
         this->num_devices -=1;
+
+        // the oldest deletion is forgotten to make room
+        Tombstone* tombstone = &this->deletions[this->next_deletion];
+        if (tombstone->version) {
+            this->forgotten_before = tombstone->version;
+        };
+        memcpy(tombstone->id, id, 4);
+        tombstone->version = this->next_version();
+        this->next_deletion = (this->next_deletion + 1) % DELETION_LOG;
+
         this->is_current = false;
         if (this->current_device_index==i) {
             this->current_device_index++;
@@ -164,13 +219,14 @@ HRESULT SmartHomeState::remove_device(char id[4]) {
     };
     return E_STATE_NO_KNOWN_DEVICE;
 }
-HRESULT SmartHomeState::overwrite_device(Device device) {
-    NUMBER index = this->get_device_index_by_id(device.id);
+HRESULT SmartHomeState::overwrite_device(const Device* device) {
+    NUMBER index = this->get_device_index_by_id(device->id);
     if (index == -1) {
         return E_STATE_NO_KNOWN_DEVICE;
     };
 
-    this->devices[index] = device;
+    this->devices[index] = *device;
+    this->touch(index);
     this->is_current = false;
     return S_OK;
 }
@@ -190,7 +246,7 @@ bool SmartHomeState::device_meets_state_criteria(NUMBER device_index) {
     };
 }
 
-DisplayFlags SmartHomeState::current_device(Device* device) {
+DisplayFlags SmartHomeState::current_device(const Device** device) {
     // we can cheat here by getting the device before the current device+1
     // instead of recalculating extra state
     this->current_device_index += 1;
@@ -204,7 +260,7 @@ DisplayFlags SmartHomeState::current_device(Device* device) {
     }
 };
 
-DisplayFlags SmartHomeState::next_device(Device* device) {
+DisplayFlags SmartHomeState::next_device(const Device** device) {
     if (this->num_devices == 0) {
         return NO_DEVICES;
     };
@@ -218,7 +274,7 @@ DisplayFlags SmartHomeState::next_device(Device* device) {
 
         if (!this->devices_slots_free[i] && this->device_meets_state_criteria(i)) {
             if (!found_device) {
-                *device = this->devices[i];
+                *device = &this->devices[i];
                 this->current_device_index = i;
                 found_device = true;
             } else {
@@ -245,18 +301,21 @@ DisplayFlags SmartHomeState::next_device(Device* device) {
         flags = flags & ~AT_TOP;
     }
 
-    switch (device->type) {
+    switch ((*device)->type) {
         case Thermostat:
         case Light:
         case Speaker:
             flags = flags | DISPLAY_POWER;
+            break;
+        default:
+            break;
     };
 
 
     return flags;
 };
 
-DisplayFlags SmartHomeState::prev_device(Device* device) {
+DisplayFlags SmartHomeState::prev_device(const Device** device) {
     if (this->num_devices == 0) {
         return NO_DEVICES;
     };
@@ -270,7 +329,7 @@ DisplayFlags SmartHomeState::prev_device(Device* device) {
 
         if (!this->devices_slots_free[i] && this->device_meets_state_criteria(i)) {
             if (!found_device) {
-                *device = this->devices[i];
+                *device = &this->devices[i];
                 this->current_device_index = i;
                 found_device = true;
             } else {
@@ -292,11 +351,14 @@ DisplayFlags SmartHomeState::prev_device(Device* device) {
         };
     };
 
-    switch (device->type) {
+    switch ((*device)->type) {
         case Thermostat:
         case Light:
         case Speaker:
             flags = flags | DISPLAY_POWER;
+            break;
+        default:
+            break;
     };
 
 
@@ -310,17 +372,14 @@ HRESULT SmartHomeState::set_device_state(char id[4], bool state) {
     };
 
     this->devices[index].state = state;
+    this->touch(index);
     this->is_current = false;
     return S_OK;
 };
 
-HRESULT SmartHomeState::set_device_power(char id[4], NUMBER power) {
-    NUMBER index = this->get_device_index_by_id(id);
-
-    if (index == -1) {
-        return E_STATE_NO_KNOWN_DEVICE;
-    };
-
+// power is range checked as an int before it is narrowed into the device
+// otherwise 300 would wrap to 44 and be accepted
+HRESULT SmartHomeState::check_power(NUMBER index, int power) {
     switch (this->devices[index].type) {
         case Thermostat:
             if (power < 9 || power > 32) {
@@ -336,27 +395,189 @@ HRESULT SmartHomeState::set_device_power(char id[4], NUMBER power) {
         default:
             return E_COMMAND_DEVICE_FEATURE_MISMATCH;
     };
+    return S_OK;
+};
+
+HRESULT SmartHomeState::set_device_power(char id[4], int power) {
+    NUMBER index = this->get_device_index_by_id(id);
+
+    if (index == -1) {
+        return E_STATE_NO_KNOWN_DEVICE;
+    };
+
+    HRESULT hresult = this->check_power(index, power);
+    if (hresult != S_OK) {
+        return hresult;
+    };
 
     this->devices[index].power = power;
+    this->touch(index);
     this->is_current = false;
     return S_OK;
 };
 
-void SmartHomeState::update_pressed_buttons(int state) {
-    unsigned long current_timestamp = millis();
+// 0 means never changed so it is skipped when the version wraps
+Version SmartHomeState::next_version() {
+    if (++this->version == 0) {
+        ++this->version;
+    };
+    return this->version;
+};
+
+void SmartHomeState::touch(NUMBER index) {
+    this->device_versions[index] = this->next_version();
+};
+
+Version SmartHomeState::current_version() {
+    return this->version;
+};
+
+Version SmartHomeState::current_epoch() {
+    return this->epoch;
+};
+
+// true if a delta from since would miss something
+// (since is from another boot, or a deletion after since has been forgotten)
+// a host at forgotten_before has already seen that deletion
+// without storage every boot looks the same so it is always a full resync
+bool SmartHomeState::sync_needs_full(Version epoch, Version since) {
+    if (!this->epoch || epoch != this->epoch) {
+        return true;
+    };
+    if ((int16_t) (this->version - since) < 0) {
+        return true;
+    };
+    return this->forgotten_before && (int16_t) (this->forgotten_before - since) > 0;
+};
+
+// the device in slot if it has changed after since, NULL otherwise
+// every device counts as changed when a full resync is needed
+const Device* SmartHomeState::changed_device(NUMBER slot, Version epoch, Version since) {
+    if (this->devices_slots_free[slot]) {
+        return NULL;
+    };
+    if (!this->sync_needs_full(epoch, since) && (int16_t) (this->device_versions[slot] - since) <= 0) {
+        return NULL;
+    };
+    return &this->devices[slot];
+};
+
+// the id of the nth remembered deletion if it happened after since, NULL otherwise
+// none are given for a full resync, the host starts again from empty
+const char* SmartHomeState::deleted_device(NUMBER n, Version epoch, Version since) {
+    Tombstone* tombstone = &this->deletions[n];
+    if (this->sync_needs_full(epoch, since) || !tombstone->version || (int16_t) (tombstone->version - since) <= 0) {
+        return NULL;
+    };
+    return tombstone->id;
+};
+
+// writes only what changed after since to the output
+// F                  the host must clear its mirror first (full resync)
+// X ID               ID was removed
+// U ID T S P LOC     ID was added or changed (type, state 0/1, power, location)
+// V EPOCH VERSION    always last, the host sends these in its next SYNC
+HRESULT SmartHomeState::send_changes_since(Version epoch, Version since) {
+    if (!this->output) {
+        return E_STATE_GENERAL_ERROR;
+    };
+    Print* out = this->output;
+
+    if (this->sync_needs_full(epoch, since)) {
+        out->println('F');
+    };
+
+    for (NUMBER i = 0; i < DELETION_LOG; i++) {
+        const char* id = this->deleted_device(i, epoch, since);
+        if (id) {
+            out->print(F("X "));
+            out->println(id);
+        };
+    };
+
+    for (NUMBER i = 0; i < MAX_CAPACITY; i++) {
+        const Device* device = this->changed_device(i, epoch, since);
+        if (!device) {
+            continue;
+        };
+        out->print(F("U "));
+        out->print(device->id);
+        out->print(' ');
+        out->print(device_type_to_char(device->type));
+        out->print(' ');
+        out->print(device->state ? '1' : '0');
+        out->print(' ');
+        out->print((int) device->power);
+        out->print(' ');
+        out->println(device->location);
+    };
+
+    out->print(F("V "));
+    out->print(this->epoch);
+    out->print(' ');
+    out->println(this->version);
+    return S_OK;
+};
+
+// checked now with the same rules as set_device_power
+// so a bad value is rejected to the sender instead of failing later
+// now, delay and period are in ms
+HRESULT SmartHomeState::schedule_action(char id[4], ScheduledActionType type, int value, unsigned long now, unsigned long delay, unsigned long period) {
+    NUMBER index = this->get_device_index_by_id(id);
+    if (index == -1) {
+        return E_STATE_NO_KNOWN_DEVICE;
+    };
+
+    if (type == SetPower) {
+        HRESULT hresult = this->check_power(index, value);
+        if (hresult != S_OK) {
+            return hresult;
+        };
+    };
+
+    return this->scheduler.add(id, type, value, now + delay, period);
+};
+
+NUMBER SmartHomeState::cancel_scheduled(char id[4]) {
+    return this->scheduler.cancel(id);
+};
+
+// runs one due action and hands back how it went
+// call until it returns false
+bool SmartHomeState::run_next_scheduled(unsigned long now, HRESULT* result) {
+    ScheduledAction action;
 
-    const int buttons[NUM_BUTTONS] = {
-        BUTTON_UP,
-        BUTTON_DOWN,
-        BUTTON_LEFT,
-        BUTTON_RIGHT,
-        BUTTON_SELECT,
+    if (!this->scheduler.pop_due(now, &action)) {
+        return false;
     };
 
+    HRESULT hresult;
+    if (action.type == SetState) {
+        hresult = this->set_device_state(action.id, action.value);
+    } else {
+        hresult = this->set_device_power(action.id, action.value);
+    };
+
+    // repeat from when it was due rather than now
+    // so a late loop doesnt make it drift
+    // anything that failed (device gone or changed type) would only fail again
+    if (action.period && hresult == S_OK) {
+        this->scheduler.add(action.id, action.type, action.value, action.due + action.period, action.period);
+    };
+
+    *result = hresult;
+    return true;
+};
+
+bool SmartHomeState::next_scheduled_deadline(unsigned long* deadline) {
+    return this->scheduler.next_deadline(deadline);
+};
+
+void SmartHomeState::update_pressed_buttons(int state, unsigned long current_timestamp) {
     for (NUMBER i = 0; i < NUM_BUTTONS; i++) {
 
         bool stored_as_down = (this->buttons_down_since[i] != 0);
-        bool button_is_down = (state & buttons[i]);
+        bool button_is_down = (state & pgm_read_byte(&BUTTONS[i]));
 
         if (button_is_down && !stored_as_down) {
             this->buttons_down_since[i] = current_timestamp;
@@ -370,22 +591,12 @@ void SmartHomeState::update_pressed_buttons(int state) {
 // This function may not be correct when a button is pressed down
 // at one of every EXACTLY maxsize(unsigned long) ms
 // but this is 1ms every ~50 days and is probably accceptable
-bool SmartHomeState::button_down_for(int button, unsigned long time) {
-    unsigned long current_timestamp = millis();
-
-    const int buttons[NUM_BUTTONS] = {
-        BUTTON_UP,
-        BUTTON_DOWN,
-        BUTTON_LEFT,
-        BUTTON_RIGHT,
-        BUTTON_SELECT,
-    };
-
+bool SmartHomeState::button_down_for(int button, unsigned long time, unsigned long current_timestamp) {
     for (NUMBER i = 0; i < NUM_BUTTONS; i++) {
         //Select the button
         // this could be done with a map
         // but that allocates on the heap
-        if (buttons[i] & button) {
+        if (pgm_read_byte(&BUTTONS[i]) & button) {
             unsigned long stored_timestamp = this->buttons_down_since[i];
             return (stored_timestamp && ((current_timestamp - stored_timestamp) > time));
         };
@@ -394,11 +605,15 @@ bool SmartHomeState::button_down_for(int button, unsigned long time) {
 
 };
 
-// writes over ANYTHING in the eeprom
-HRESULT SmartHomeState::write_devices_to_eeprom() {
-    unsigned int eeprom_pointer = 0;
+// writes over ANYTHING in the storage
+HRESULT SmartHomeState::write_devices_to_storage() {
+    if (!this->storage) {
+        return E_STATE_GENERAL_ERROR;
+    };
+
+    unsigned int storage_pointer = 0;
 
-    unsigned int eeprom_length = EEPROM.length()-1;
+    unsigned int storage_length = this->storage->length() - BOOT_EPOCH_BYTES - 1;
 
 
     for (NUMBER i = 0; i < MAX_CAPACITY; i++) {
@@ -410,56 +625,81 @@ HRESULT SmartHomeState::write_devices_to_eeprom() {
         unsigned char size = sizeof this->devices[i];
 
 
-        if ((eeprom_pointer + size + 4) > eeprom_length) {
+        if ((storage_pointer + size + 4) > storage_length) {
+            this->storage->commit();
             return E_STATE_EEPROM_FULL;
         };
 
 
         // [SIG1, SIG2, SIZE, DEVICE... , TERMIATOR]
-        EEPROM.put(eeprom_pointer++, EEPROM_SIG_BYTE_1);
-        EEPROM.put(eeprom_pointer++, EEPROM_SIG_BYTE_2);
-        EEPROM.put(eeprom_pointer++, size);
-        EEPROM.put(eeprom_pointer, this->devices[i]);
-        
-        eeprom_pointer += size;
+        const unsigned char header[3] = {EEPROM_SIG_BYTE_1, EEPROM_SIG_BYTE_2, size};
+        const unsigned char terminator = EEPROM_TERMINATING_BYTE;
 
-        EEPROM.put(eeprom_pointer++, EEPROM_TERMINATING_BYTE);
+        this->storage->write_block(storage_pointer, header, 3);
+        storage_pointer += 3;
+        this->storage->write_block(storage_pointer, &this->devices[i], size);
+        storage_pointer += size;
+        this->storage->write_block(storage_pointer++, &terminator, 1);
 
     };
 
+    this->storage->commit();
     return S_OK;
 }
 
-NUMBER SmartHomeState::read_devices_from_eeprom() {
+NUMBER SmartHomeState::read_devices_from_storage() {
+    if (!this->storage) {
+        return 0;
+    };
 
     NUMBER devices_read = 0;
+    unsigned int storage_length = this->storage->length() - BOOT_EPOCH_BYTES;
 
-    for (unsigned int eeprom_pointer = 0; eeprom_pointer < EEPROM.length(); eeprom_pointer++) {
+    // memory mapped stores are scanned in place
+    // only the records that match are copied (into the device table)
+    const unsigned char* view = this->storage->view();
 
-        if (EEPROM.read(eeprom_pointer) != EEPROM_SIG_BYTE_1) {
+    for (unsigned int storage_pointer = 0; storage_pointer + 3 < storage_length; storage_pointer++) {
+
+        unsigned char sig1 = view ? view[storage_pointer] : this->storage->read(storage_pointer);
+        if (sig1 != EEPROM_SIG_BYTE_1) {
             continue;
         };
-            if (EEPROM.read(eeprom_pointer+1) != EEPROM_SIG_BYTE_2) {
+        unsigned char sig2 = view ? view[storage_pointer+1] : this->storage->read(storage_pointer+1);
+        if (sig2 != EEPROM_SIG_BYTE_2) {
             continue;
         };
 
-        unsigned char size = EEPROM.read(eeprom_pointer+2);
+        unsigned char size = view ? view[storage_pointer+2] : this->storage->read(storage_pointer+2);
+
+        // a record written by a different layout of Device cant be loaded
+        if (size != sizeof(Device) || storage_pointer+3+size >= storage_length) {
+            continue;
+        };
 
         // this should remove almost every false positive
-        if (EEPROM.read(eeprom_pointer+3+size) != EEPROM_TERMINATING_BYTE) {
+        unsigned char terminator = view ? view[storage_pointer+3+size] : this->storage->read(storage_pointer+3+size);
+        if (terminator != EEPROM_TERMINATING_BYTE) {
             continue;
         };
 
-        Device device;
-        EEPROM.get(eeprom_pointer+3, device);
+        HRESULT hresult;
+        if (view) {
+            // Device is all chars so it is safe to point at any byte
+            hresult = this->add_device((const Device*) (view + storage_pointer + 3));
+        } else {
+            Device device;
+            this->storage->read_block(storage_pointer+3, &device, size);
+            hresult = this->add_device(&device);
+        };
 
-        if (this->add_device(device) == S_OK) {
+        if (hresult == S_OK) {
             devices_read++;
         };
         
         // set the pointer to the terminating byte
         // because the next iteration will add 1 to the pointer
-        eeprom_pointer += 3+size;
+        storage_pointer += 3+size;
     };
 
     return devices_read;
@@ -535,26 +775,3 @@ void fill_char_with_int(char str[], int x, int digits) {
         str[i] = ' ';
     };
 };
-
-// the code on learn didnt work for me (idk why)
-// maybe because i have not allocated on the heap (i hope..)
-uintptr_t calculate_free_memory() {
-    // ref to stack var can be treated
-    // as the top of stack pointer
-    char sp;
-
-    if ((uintptr_t) __brkval) {
-        // BOUNDRY BETWEEN STACK AND HEAP
-        return &sp - __brkval;
-    } else {
-        // start of the heap allocation
-        //return &sp - __malloc_heap_start;
-
-        // work out ourselves
-        uintptr_t ptr = malloc(1);
-        free((void *) ptr);
-
-        return &sp - ptr;;
-    };
-};
-
@@ -3,6 +3,8 @@
 
 #include "device.h"
 #include "errors.h"
+#include "scheduler.h"
+#include "storage.h"
 #include <Arduino.h>
 
 #define MIN_COMMAND_LEN 5
@@ -12,7 +14,8 @@
 
 
 // char literals take octal byte sequence
-//[0, 77, device_len_in_bytes, DEVICE...., 79] is how eeprom is formatted
+//[0, 77, device_len_in_bytes, DEVICE...., 79] is how storage is formatted
+// (the names are from when it could only be the eeprom)
 #define EEPROM_SIG_BYTE_1 '\0'
 #define EEPROM_SIG_BYTE_2 '\115'
 #define EEPROM_TERMINATING_BYTE '\117'
@@ -34,6 +37,23 @@
 #define NO_DEVICES 0b1000u
 #define DisplayFlags unsigned NUMBER
 
+// deletions remembered for delta sync
+// a host further behind than this has to resync in full
+#define DELETION_LOG 4
+
+// versions are 16 bit to save ram and compared with wrap around
+// so a host must sync at least every 32767 changes
+#define Version uint16_t
+
+// the last bytes of storage count boots so a host can tell
+// versions from before a reboot apart from the ones after it
+#define BOOT_EPOCH_BYTES 2
+
+struct Tombstone {
+    char id[4];
+    Version version;
+};
+
 
 
 enum DisplayMode {
@@ -50,8 +70,8 @@ class SmartHomeState {
         NUMBER num_devices;
         Device devices[MAX_CAPACITY];
         bool devices_slots_free[MAX_CAPACITY];
-        NUMBER get_device_index_by_id(char[4]);
-        NUMBER insert(char[4]);
+        NUMBER get_device_index_by_id(const char[4]);
+        NUMBER insert(const char[4]);
         bool shuffle_up(NUMBER);
         bool shuffle_down(NUMBER);
         NUMBER next_free_index();
@@ -60,34 +80,82 @@ class SmartHomeState {
         // Button State
         unsigned long buttons_down_since[NUM_BUTTONS];
 
+        // Scheduled Actions
+        Scheduler scheduler;
+
+        // Persistence
+        Storage* storage;
+
+        // Replies that are more than a status code (SYNC)
+        Print* output;
+
+        // Delta Sync
+        // versions move with their device when the table is shuffled
+        Version epoch; // 0 when there is no storage to count boots in
+        Version version;
+        Version device_versions[MAX_CAPACITY];
+        Tombstone deletions[DELETION_LOG];
+        unsigned NUMBER next_deletion;
+        Version forgotten_before; // version of the newest deletion that has been dropped
+        Version next_version();
+        void touch(NUMBER);
+        HRESULT check_power(NUMBER, int);
+
     public:
         //Constructor
         SmartHomeState();
 
         // Button state
-        bool button_down_for(int, unsigned long);
-        void update_pressed_buttons(int);
+        // times are passed in (millis() on the hub) so the engine
+        // has no clock of its own and can run anywhere
+        bool button_down_for(int, unsigned long, unsigned long);
+        void update_pressed_buttons(int, unsigned long);
 
         // Display State
         bool is_current;
         enum DisplayMode display_mode;
 
         // Device Storage
-        DisplayFlags next_device(Device*);
-        DisplayFlags prev_device(Device*);
-        DisplayFlags current_device(Device*);
-        HRESULT add_device(Device);
+        // navigation hands out a read only view into the device table
+        // instead of a copy, the view is only valid until the next
+        // mutation (every mutation sets is_current = false)
+        DisplayFlags next_device(const Device**);
+        DisplayFlags prev_device(const Device**);
+        DisplayFlags current_device(const Device**);
+        HRESULT add_device(const Device*);
         HRESULT remove_device(char[4]);
-        HRESULT overwrite_device(Device);
+        HRESULT overwrite_device(const Device*);
         NUMBER device_count();
 
         // Device Modification
         HRESULT set_device_state(char[4], bool);
-        HRESULT set_device_power(char[4], NUMBER);
-
-        // eeprom
-        HRESULT write_devices_to_eeprom();
-        NUMBER read_devices_from_eeprom();
+        HRESULT set_device_power(char[4], int);
+
+        // Scheduled Modification
+        // these go through set_device_state/set_device_power when they fire
+        HRESULT schedule_action(char[4], ScheduledActionType, int, unsigned long, unsigned long, unsigned long);
+        NUMBER cancel_scheduled(char[4]);
+        bool run_next_scheduled(unsigned long, HRESULT*);
+        bool next_scheduled_deadline(unsigned long*);
+
+        // Delta Sync
+        // every mutation bumps the version and stamps what it changed
+        // versions restart at boot so they are only meaningful with the epoch
+        // the host was given them in, a different epoch always resyncs in full
+        Version current_version();
+        Version current_epoch();
+        bool sync_needs_full(Version, Version);
+        const Device* changed_device(NUMBER, Version, Version);
+        const char* deleted_device(NUMBER, Version, Version);
+        HRESULT send_changes_since(Version, Version);
+        void use_output(Print*);
+
+        // persistence
+        // nothing is saved or loaded until a backend is given
+        // giving one starts a new boot epoch
+        void use_storage(Storage*);
+        HRESULT write_devices_to_storage();
+        NUMBER read_devices_from_storage();
 
 };
 
@@ -96,6 +164,4 @@ bool is_supported_char(char[], int, bool);
 void fill_char_with_int(char[], int, int);
 
 
-uintptr_t calculate_free_memory();
-
 #endif
\ No newline at end of file